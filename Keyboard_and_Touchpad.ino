@@ -27,14 +27,43 @@
 // Rev 3.1  - July 7, 2018 - Added watchdog timer to touchpad routine to break out of while loops. This fixed 
 //                           the lock up problem at startup and reset.
 // Rev 3.2  - Nov 30, 2018 - Added Apache License header. Replaced playground arduino ps/2 touchpad code with my code. 
+// Rev 4.0  - Oct 17, 2026 - Replaced the per key code blocks in loop with a table driven keyboard matrix scan.
+// Rev 4.1  - Oct 17, 2026 - Touchpad bytes are received by a pin change interrupt on the clock instead of busy waiting.
+//                           The loop collects the reply to the request data command on later passes.
+// Rev 4.2  - Oct 17, 2026 - Touchpad runs in stream mode at 200 samples/sec. Packets are put together as they
+//                           arrive and sent over usb right away, including while the loop waits between scans.
+// Rev 4.3  - Oct 17, 2026 - Replaced the delay at the end of loop with a scheduler of periodic tasks. The lcd pulses,
+//                           display blink and power off wait are timed pin actions so the keys keep scanning.
+// Rev 4.4  - Oct 17, 2026 - The Fn key lcd sequences and the display blink are step tables run by an lcd macro task.
+// Rev 4.5  - Oct 17, 2026 - Added a debounce for every key (eager or deferred) and raised the scan rate to 500 per second.
+// Rev 4.6  - Oct 17, 2026 - The usb keyboard report is built from the bit map of pressed keys, once per scan.
+//                           Replaced the 6 key slots. More than 6 keys sends ErrorRollOver instead of dropping keys.
+// Rev 4.7  - Oct 17, 2026 - Keyboard and touchpad changes are gathered and sent by a usb task, at most one keyboard
+//                           and one mouse report per usb frame. Counts the reports sent and saved.
+// Rev 4.8  - Oct 17, 2026 - Battery voltage is worked out with a formula instead of the 30 step if/else ladder.
+//                           Added a binary register mode to the i2c request (mV, version, status and error counts).
+// Rev 4.9  - Oct 17, 2026 - The scan, touchpad, adc, usb and loop times are measured with micros() into min/avg/max
+//                           and a histogram, with touchpad timeout and rollover counts, in a second register window.
+// Rev 5.0  - Oct 17, 2026 - The Fn & F1, F3, F4, F7 and F12 controls act on the press and release edges of the key
+//                           instead of waiting in a loop for the release, so holding one doesn't stop the other tasks.
+// Rev 5.1  - Oct 17, 2026 - The scan puts each key press and release in a queue with its time, and the usb report is
+//                           built from the queue. The time from a key change to its usb report is measured.
+// Rev 5.2  - Oct 17, 2026 - A timer 1 interrupt scans one row per tick, reading the row it drove low on the tick
+//                           before, so the column settle time is no longer spent waiting. The scan rate is set with
+//                           SCAN_RATE_HZ and the keyboard task only builds the usb reports from the key events.
+// Rev 5.3  - Oct 17, 2026 - The keymap is a set of layers compiled from keymap_layout.h, with the Fn controls,
+//                           tap/hold keys and typed macros as actions in the tables instead of code.
 //
 // The ps/2 code for the Touchpad is written from timing diagrams at http://www.burtonsys.com/ps2_chapweske.htm
 // The USB Mouse Functions are described at https://www.pjrc.com/teensy/td_mouse.html
 // The USB Keyboard Functions are described at https://www.pjrc.com/teensy/td_keyboard.html
 //
+// The sim folder compiles this file on Linux against a simulator of the keyboard, touchpad, usb host and i2c bus.
+// It is compiled as plain C++ there, so functions must be defined before they are used.
+//
 // Keyboard part number is KFRMBA151B
 // The print screen and num lock keys were not functional on my keyboard so they do not show up in the matrix.
-// The Menu key is not included in Teensyduino so it will be used as a print screen key. 
+// The Menu key is not included in Teensyduino so it is a print screen key in keymap_layout.h.
 //
 // The keyboard matrix: columns (inputs) across the top and rows (outputs) along the side 
 /*
@@ -90,6 +119,35 @@
 // Define the touchpad clock and data connections to the Teensy (bi-directional signals)
 #define TP_DATA PIN_B3 // The tp_data & tp_clk are driven low or floated (pull ups to 5V are in the touchpad chip). 
 #define TP_CLK PIN_B2 // They are also read by the Teensy as inputs.
+#define TP_CLK_PCINT PCINT2 // TP_CLK (B2) is pin change interrupt 2 of port B
+//
+// Touchpad receive and timeout settings
+#define TP_BUF_SIZE 32 // size of the receive ring buffer, must be a power of 2 (holds 10 packets)
+#define TP_BIT_TIMEOUT_US 2000 // a gap this long between clock edges means the byte being received was cut short
+#define TP_WRITE_TIMEOUT 25 // msec. The touchpad must start clocking within 15 msec of a request to send.
+#define TP_READ_TIMEOUT 200 // msec to wait for a byte during touchpad_init (covers the self test after a reset)
+#define TP_SAMPLE_RATE 200 // touchpad packets per second while it is moving (10, 20, 40, 60, 80, 100 or 200)
+//
+//
+// Task periods in msec for the scheduler in loop
+#define KEYBOARD_PERIOD 1 // build the keyboard report from the key events (one usb frame)
+#define TOUCHPAD_PERIOD 1 // send the touchpad packets (one usb frame)
+#define COMMAND_PERIOD 10 // act on the i2c commands and the Ctrl-Alt keys
+#define ADC_PERIOD 100 // battery voltage read
+#define BLINK_PERIOD 500 // Teensy LED toggle
+#define USB_PERIOD 1 // send the gathered keyboard and mouse changes (one usb frame)
+//
+// Timed pin actions
+#define MAX_PIN_ACTIONS 32 // size of the queue of timed pin actions
+#define GO_0 0 // drive the pin low
+#define GO_1 1 // drive the pin high
+#define GO_Z 2 // float the pin
+#define SHUTDOWN_WAIT 6000 // msec to give the Pi to finish shutdown before removing power
+//
+// Lcd control card macros
+#define LCD_PERIOD 1 // msec between runs of the lcd macro task
+#define LCD_QUEUE_SIZE 8 // number of macros that can wait to run
+#define LCD_END 0xff // pin value that marks the end of a macro
 //
 // Define the volume up and down, menu, and on/off controls from the Teensy to the LCD Controller card.
 // These 4 controls are initiated by holding down the Fn key and then pushing a function key as follows:
@@ -109,15 +167,187 @@
 //
 #define DISK_LED PIN_E6 // spare LED used for code debug
 //
+// Firmware version for the i2c register block (high byte = major, low byte = minor) and the battery text
+#define FW_VERSION 0x0503
+#define VERSION_TEXT "V5.3 10/17/26 FA" // 16 characters so the battery text is 32
+//
+// Battery ADC. All values read 22 bits lower than expected so there is a negative offset from something.
+// ADC 10 bit Result = [(Battery_voltage/4)/(5v/1023bits)] - 22 bits, so Battery mV = (ADC + 22) * 20000 / 1023
+#define ADC_OFFSET 22
+#define BATTERY_LOW_MV 13990 // below this (ADC 0x2b6) the text says "Battery < 14.0v"
+#define BATTERY_TEXT_MV 19 // added to the mV before it is cut to 0.1 volts, so the text steps at the ADC codes of the old table
+#define BATTERY_HIGH_TENTHS 168 // the text stops at "Battery = 16.8v" (ADC 0x345 and up), as the old table did
+//
+// The i2c register block the Pi reads in binary mode. Each register is a 16 bit word sent low byte first.
+// The first byte of an i2c write is the register number to start the next read at.
+#define REG_BATTERY_MV 0 // battery voltage in mV
+#define REG_VERSION 1 // FW_VERSION
+#define REG_STATUS 2 // status flags below
+#define REG_TP_PARITY 3 // touchpad bytes with bad parity
+#define REG_TP_FRAME 4 // touchpad bytes with a bad start or stop bit
+#define REG_TP_OVERRUN 5 // touchpad bytes lost because the receive buffer was full
+#define REG_KBD_SENT 6 // keyboard reports sent over usb
+#define REG_KBD_SAVED 7 // key changes that went out with another change
+#define REG_MOUSE_SENT 8 // mouse reports sent over usb
+#define REG_MOUSE_SAVED 9 // touchpad changes that went out with another one
+#define NUM_REGS 10
+//
+// Timing registers, a second window of the register block starting at register number REG_PERF. It is above the
+// command codes so a register number is never taken as a command. Times are in usec (micros() has a 4 usec step).
+#define REG_PERF 0x60 // register number of the first timing register
+#define PERF_TP_TIMEOUT 0 // touchpad bytes cut short plus touchpad command and read timeouts
+#define PERF_ROLLOVER 1 // keyboard reports sent as ErrorRollOver because more than 6 keys were pressed
+#define PERF_TASK_MISSES 2 // task runs that were a whole period late
+#define PERF_KEY_QUEUE_FULL 3 // rows whose key changes waited a scan because the key event queue was full
+#define PERF_PHASE 4 // first phase block, each is min, avg, max then the histogram buckets
+#define PHASE_SCAN 0 // longest row tick of each matrix pass, timer match to the end of the scan interrupt
+#define PHASE_TOUCHPAD 1 // touchpad_task
+#define PHASE_ADC 2 // adc_task
+#define PHASE_USB 3 // usb_task
+#define PHASE_LOOP 4 // a pass of loop() that ran at least one task
+#define PHASE_KEY_LATENCY 5 // scan that saw a key change to its usb report
+#define NUM_PHASES 6
+#define PHASE_NONE 0xff // task that is not timed
+#define HIST_BUCKETS 8 // bucket n counts times under 32 << n usec, the last bucket counts everything longer
+#define PHASE_REGS (3 + HIST_BUCKETS)
+#define NUM_PERF_REGS (PERF_PHASE + NUM_PHASES * PHASE_REGS)
+#define PHASE_WINDOW 0x8000 // the average and histogram are halved at this count so they follow recent runs
+#define I2C_READ_MAX 32 // bytes the Wire buffer can send in one read
+// Bits of the status register
+#define STATUS_TP_FAIL 0x0001 // touchpad failed to initialize
+#define STATUS_TP_ENABLED 0x0002 // touchpad is turned on (Fn & F12)
+#define STATUS_DEBUG_LED 0x0004 // disk led is on
+#define STATUS_SHUTDOWN 0x0008 // power off is on the way
+#define STATUS_CAPS_LOCK 0x0010 // caps lock led is on
+#define STATUS_BINARY 0x0020 // i2c reads return the register block
+//
+// Keyboard matrix size and the time to let the columns settle after a row is driven low
+#define NUM_ROWS 16
+#define NUM_COLS 8
+#define ROW_SETTLE_US 10 // microseconds
+//
+// The timer 1 compare interrupt scans one row per tick, so the whole matrix is scanned SCAN_RATE_HZ times a second.
+// Timer 1 counts at F_CPU / 8 and restarts at OCR1A.
+#define SCAN_RATE_HZ 1000 // full matrix scans per second
+#define ROW_TICKS (F_CPU / 8 / NUM_ROWS / SCAN_RATE_HZ) // timer counts per row, must fit in 16 bits
+#define ROW_TICK_US (1000000UL / NUM_ROWS / SCAN_RATE_HZ) // time a row has to settle before it is read
+#if ROW_TICK_US < ROW_SETTLE_US
+#error "SCAN_RATE_HZ is too fast for the columns to settle"
+#endif
+//
+// Debounce of the key switches. Eager mode sends a change on the first scan that sees it and then ignores the key
+// for DEBOUNCE_MS. Deferred mode sends a change after the key has read the same for DEBOUNCE_MS of scans.
+// Eager gives the lowest latency, deferred also rejects short noise spikes.
+#define DEBOUNCE_EAGER 0
+#define DEBOUNCE_DEFERRED 1
+#define DEBOUNCE_MODE DEBOUNCE_EAGER
+#define DEBOUNCE_MS 10 // msec
+#define DEBOUNCE_SCANS (DEBOUNCE_MS * SCAN_RATE_HZ / 1000) // number of scans, must be 1 thru 15
+#if (DEBOUNCE_SCANS < 1) || (DEBOUNCE_SCANS > 15)
+#error "DEBOUNCE_MS must be 1 thru 15 scans"
+#endif
+//
+// Keymap actions (see keymap_layout.h). A key or modifier is its Teensyduino name, which has 0xF000 or 0xE000 in
+// the top 4 bits. The other actions use the top 4 bits for the kind and the rest for the layer, control or macro.
+// Teensyduino's media and system keys are also 0xE000 codes but with bits 8 - 11 set, they are not modifiers and
+// can't go in a boot keyboard report, so layer_action turns them into no key.
+#define ACT_KIND 0xF000 // bits that give the kind of action
+#define ACT_KEY 0xF000 // usb key code in the low byte
+#define ACT_MOD 0xE000 // usb modifier bits in the low byte, bits 8 - 11 clear
+#define ACT_MOD_PAGE 0x0F00 // bits 8 - 11 of a 0xE000 code, set for a media or system key
+#define ACT_MO 0x1000 // layer number on while held
+#define ACT_TG 0x2000 // layer number turned on or off
+#define ACT_CTL 0x3000 // CTL_ number
+#define ACT_MACRO 0x4000 // key macro number
+#define ACT_LT 0x5000 // layer number << 8 plus the usb key code for a tap
+#define ACT_MT 0x6000 // left modifier bits << 8 plus the usb key code for a tap
+#define TRANS 0x0001 // use the layer below
+#define MO(layer) (ACT_MO | (layer))
+#define TG(layer) (ACT_TG | (layer))
+#define LT(layer, key) (ACT_LT | ((layer) << 8) | ((key) & 0xff))
+#define MT(mod, key) (ACT_MT | (((mod) & 0x0f) << 8) | ((key) & 0xff))
+#define CTL(n) (ACT_CTL | (n))
+#define MACRO(n) (ACT_MACRO | (n))
+#define SHIFT(key) ((key) | ((MODIFIERKEY_SHIFT & 0x0f) << 8)) // a macro step typed with shift
+// Laptop controls for CTL actions
+#define CTL_MENU 0 // Menu button of the lcd card, held while the key is
+#define CTL_MUTE 1 // lcd menus to toggle mute
+#define CTL_VOL_DN 2 // Vol_Dn button, held while the key is
+#define CTL_VOL_UP 3 // Vol_Up button, held while the key is
+#define CTL_BRIGHT_DN 4 // lcd menus to decrease brightness, repeats while the key is held
+#define CTL_BRIGHT_UP 5 // lcd menus to increase brightness, repeats while the key is held
+#define CTL_ON_OFF 6 // On_Off button, held while the key is
+#define CTL_TOUCHPAD 7 // turn the touchpad on or off
+#define TAP_HOLD_MS 200 // a tap/hold key held this long is a hold
+#define NO_KEY 0xff // key number for none
+//
+// Key event queue from the matrix scan to the usb report. An event is the key number (row * 8 + col) with
+// KEY_EVENT_PRESS set for a press, and the micros() time of the scan that saw it.
+#define KEY_EVENT_SIZE 32 // must be a power of 2
+#define KEY_EVENT_PRESS 0x80
+//
+// The usb boot keyboard report holds 6 normal keys. When more are pressed all 6 are sent as this code.
+#define KEY_ERROR_ROLLOVER 0x01
+#define REPORT_KEYS 6
+//
+// The 16 row pins in scan order. Row n of the matrix is driven by row_pins[n].
+const uint8_t row_pins[NUM_ROWS] = {Row0, Row1, Row2, Row3, Row4, Row5, Row6, Row7,
+                                    Row8, Row9, Row10, Row11, Row12, Row13, Row14, Row15};
+// The 8 column pins. Bit n of a column read is Col n.
+const uint8_t col_pins[NUM_COLS] = {Col0, Col1, Col2, Col3, Col4, Col5, Col6, Col7};
+//
+// The keymap is compiled from keymap_layout.h. The first pass numbers the layers and macros, the second makes a
+// table of each macro's keys, and the third makes the layer tables. Each layer holds the action of key number
+// row * NUM_COLS + col, so finding the action of a key is one table read per active layer.
+// The tables are constant so they are kept in flash and read with pgm_read_word.
+#define LAYER(name, ...) name,
+#define KEY_MACRO(name, ...)
+enum {
+#include "keymap_layout.h"
+  NUM_LAYERS
+};
+static_assert(NUM_LAYERS <= 8, "keymap_layout.h has more than 8 layers, layer_on has one bit per layer");
+#undef LAYER
+#undef KEY_MACRO
+#define LAYER(name, ...)
+#define KEY_MACRO(name, ...) name,
+enum {
+#include "keymap_layout.h"
+  NUM_KEY_MACROS
+};
+#undef KEY_MACRO
+#define KEY_MACRO(name, ...) const uint16_t name##_keys[] PROGMEM = { __VA_ARGS__, 0 };
+#include "keymap_layout.h"
+#undef KEY_MACRO
+#define KEY_MACRO(name, ...) name##_keys,
+const uint16_t *const key_macros[NUM_KEY_MACROS] = { // step list of each macro, ended by a 0
+#include "keymap_layout.h"
+};
+#undef LAYER
+#undef KEY_MACRO
+#define LAYER(name, ...) { __VA_ARGS__ },
+#define KEY_MACRO(name, ...)
+const uint16_t keymap[NUM_LAYERS][NUM_ROWS * NUM_COLS] PROGMEM = {
+#include "keymap_layout.h"
+};
+#undef LAYER
+#undef KEY_MACRO
+//
 // Declare variables that will be used by functions
-boolean slots_full = LOW; // Goes high when slots 1 thru 6 contain keys
-// slot 1 thru slot 6 hold the normal key values to be sent over USB. 
-int slot1 = 0; //value of 0 means the slot is empty and can be used.  
-int slot2 = 0; 
-int slot3 = 0; 
-int slot4 = 0; 
-int slot5 = 0; 
-int slot6 = 0;
+uint8_t key_state[NUM_ROWS]; // 128 bit map of the debounced switches that are pressed. One byte per row, bit n = Col n.
+uint8_t key_down[NUM_ROWS]; // 128 bit map of the pressed keys as taken from the key event queue (the report side)
+uint8_t deb_cnt0[NUM_ROWS]; // 4 bit debounce counter for every key, one bit of the count in each array
+uint8_t deb_cnt1[NUM_ROWS]; // (bit n of deb_cnt0 thru deb_cnt3 make the count for Col n)
+uint8_t deb_cnt2[NUM_ROWS];
+uint8_t deb_cnt3[NUM_ROWS];
+volatile uint8_t scan_row_num = 0; // row the scan interrupt drove low, it is read on the next tick
+uint16_t scan_ticks_max = 0; // longest row tick of the pass being scanned, in timer 1 counts (the scan interrupt's)
+volatile uint16_t scan_pass_ticks = 0; // longest row tick of the last finished pass
+volatile uint8_t scan_passes = 0; // finished passes, counted by the scan interrupt
+uint8_t scan_passes_timed = 0; // scan_passes when PHASE_SCAN was last recorded
+uint8_t old_state[NUM_ROWS]; // 128 bit map of the keys sending a usb key code in the keyboard report
+uint8_t special_state[NUM_ROWS]; // bit map of the keys held as a modifier or a layer
+uint16_t key_action[NUM_ROWS * NUM_COLS]; // action each key took from the layers when it was pressed
 //
 // Declare variables that pi controls and reads via i2c
 boolean debug = LOW; // HIGH turns on the DISK_LED (used for code debug)
@@ -126,58 +356,43 @@ boolean kill_power = LOW; // HIGH disables all 3 voltage regulators
 boolean blink_display = LOW; // HIGH causes LCD display to blink off and back on
 int adc_ave; //  holds the A to D conversion of the battery/4 value
 //
+// Declare variables for the i2c reads
+boolean binary_mode = LOW; // HIGH = reads return the register block, LOW = reads return the battery text
+uint8_t reg_pointer = 0; // index in i2c_regs the next read starts at
+uint16_t i2c_regs[NUM_REGS + NUM_PERF_REGS]; // register block then the timing window, filled in by the tasks
+boolean clear_stats = LOW; // HIGH clears the timing registers at the next command task
+char battery_text[33] = "Battery = 00.0v " VERSION_TEXT; // 32 characters sent in text mode
+//
 boolean touchpad_error = LOW; // sent high when touch pad routine times out
 boolean touchpad_fail = LOW; // sent high if the touchpad won't initialize
 //
-// Function to clear the slot that contains the key name
-void clear_slot(int key) {
-  if (slot1 == key) {
-    slot1 = 0;
-  }
-  else if (slot2 == key) {
-    slot2 = 0;
-  }
- else if (slot3 == key) {
-    slot3 = 0;
-  }
- else if (slot4 == key) {
-    slot4 = 0;
-  }
- else if (slot5 == key) {
-    slot5 = 0;
-  }
- else {
-    slot6 = 0;
-  }
-  slots_full = LOW;
-}
-// Function to load the key name into the first available slot
-void load_slot(int key) {
-  if (!slot1)  {
-    slot1 = key;
-  }
-  else if (!slot2) {
-    slot2 = key;
-  }
-  else if (!slot3) {
-    slot3 = key;
-  }
-  else if (!slot4) {
-    slot4 = key;
-  }
-  else if (!slot5) {
-    slot5 = key;
-  }
-  else {
-    slot6 = key;
-  }
-  if (!slot1 || !slot2 || !slot3 || !slot4 || !slot5 || !slot6)  {
-    slots_full = LOW;
-  }
-  else {
-    slots_full = HIGH;
-  }
-}
+// Key event queue. The scan interrupt is the only writer of key_event_head and the report side the only writer of
+// key_event_tail, so neither side needs to turn off interrupts (a uint8_t is written in one instruction).
+struct key_event {
+  uint8_t key; // row * NUM_COLS + col, plus KEY_EVENT_PRESS for a press
+  unsigned long usec; // micros() of the scan that saw the change
+};
+volatile key_event key_events[KEY_EVENT_SIZE];
+volatile uint8_t key_event_head = 0; // next location the scan writes
+volatile uint8_t key_event_tail = 0; // next location the report side reads. The queue is empty when head = tail.
+volatile uint8_t key_event_pass = 0; // key_event_head at the end of the last full pass of the matrix. The report
+// side only reads up to here so keys pressed together (e.g. Ctrl Alt R) that were seen in different rows of the
+// same pass go in the same report.
+volatile uint16_t key_queue_full = 0; // rows whose changes waited a scan because the queue was full
+//
+// Touchpad receive variables shared with the pin change interrupt
+volatile uint8_t tp_buf[TP_BUF_SIZE]; // ring buffer of the bytes received from the touchpad
+volatile uint8_t tp_head = 0; // next location the interrupt writes
+volatile uint8_t tp_tail = 0; // next location tp_read reads. The buffer is empty when head = tail.
+volatile uint16_t tp_frame = 0; // start, data, parity and stop bits of the byte being received
+volatile uint8_t tp_bit_count = 0; // number of bits received so far
+volatile unsigned long tp_last_edge = 0; // micros of the last falling clock edge
+volatile boolean tp_rx_error = LOW; // set by the interrupt when a byte is thrown away
+volatile uint8_t tp_parity_errors = 0; // count of bytes with bad parity
+volatile uint8_t tp_frame_errors = 0; // count of bytes with a bad start or stop bit
+volatile uint8_t tp_overruns = 0; // count of bytes lost because the ring buffer was full
+volatile uint8_t tp_timeouts = 0; // count of bytes cut short and touchpad commands or reads that timed out
+//
 // Function to send a pin to high impedance (float)
 void go_z(int pin)
 {
@@ -196,12 +411,132 @@ void go_1(int pin)
   pinMode(pin, OUTPUT);
   digitalWrite(pin, HIGH);  
 }
+// The row pins are driven by the scan interrupt with direct register writes, as a pinMode and digitalWrite each
+// tick would take most of the tick. keyboard_init fills in the DDR and PORT register and bit of every row.
+#if defined(__AVR_AT90USB1286__)
+volatile uint8_t *row_ddr[NUM_ROWS];
+volatile uint8_t *row_port[NUM_ROWS];
+uint8_t row_bit[NUM_ROWS];
+#endif
+// Function to drive a row low
+void row_on(uint8_t row)
+{
+#if defined(__AVR_AT90USB1286__)
+  *row_port[row] = *row_port[row] & ~row_bit[row]; // pullup off, then output low
+  *row_ddr[row] = *row_ddr[row] | row_bit[row];
+#else
+  go_0(row_pins[row]);
+#endif
+}
+// Function to send a row back to the off state (input with pullup, same as go_z)
+void row_off(uint8_t row)
+{
+#if defined(__AVR_AT90USB1286__)
+  *row_ddr[row] = *row_ddr[row] & ~row_bit[row];
+  *row_port[row] = *row_port[row] | row_bit[row];
+#else
+  go_z(row_pins[row]);
+#endif
+}
+// Function to read the 8 columns of the row that is driven low. Bit n is set if Col n is low (key pressed).
+uint8_t read_columns()
+{
+#if defined(__AVR_AT90USB1286__)
+  // The columns are spread over ports A, C and E so each port is read once and the bits are gathered
+  uint8_t port_a = PINA;
+  uint8_t port_c = PINC;
+  uint8_t port_e = PINE;
+  uint8_t cols = (port_e & 0x01)           // Col0 = E0
+               | ((port_e >> 3) & 0x02)    // Col1 = E4
+               | ((port_c << 1) & 0x04)    // Col2 = C1
+               | ((port_a << 3) & 0x08)    // Col3 = A0
+               | ((port_c << 2) & 0x10)    // Col4 = C2
+               | (port_a & 0x20)           // Col5 = A5
+               | ((port_c << 2) & 0x40)    // Col6 = C4
+               | ((port_a << 1) & 0x80);   // Col7 = A6
+  return ~cols; // a pressed key pulls its column low
+#else
+  uint8_t cols = 0;
+  for (uint8_t col = 0; col < NUM_COLS; col++) {
+    if (!digitalRead(col_pins[col])) { // a pressed key pulls its column low
+      cols = cols | (1 << col);
+    }
+  }
+  return cols;
+#endif
+}
+// Pin change interrupt for the touchpad clock. The touchpad changes the data while the clock is high and the
+// Teensy reads it on the falling edge. A byte is 11 bits: start (0), 8 data bits lsb first, odd parity, stop (1).
+ISR(PCINT0_vect)
+{
+  if (digitalRead(TP_CLK) == HIGH) { // only the falling edge of the clock is used
+    return;
+  }
+  unsigned long edge = micros();
+  if ((edge - tp_last_edge) > TP_BIT_TIMEOUT_US) { // the last byte stopped part way so start a new one
+    if (tp_bit_count) {
+      tp_timeouts++;
+    }
+    tp_bit_count = 0;
+  }
+  tp_last_edge = edge;
+  if (tp_bit_count == 0) {
+    tp_frame = 0;
+  }
+  if (digitalRead(TP_DATA)) {
+    tp_frame = tp_frame | (1 << tp_bit_count); // bit n of the frame is the nth bit received
+  }
+  tp_bit_count++;
+  if (tp_bit_count < 11) { // wait for the rest of the byte
+    return;
+  }
+  tp_bit_count = 0;
+  uint8_t data = tp_frame >> 1;
+  uint8_t ones = data ^ ((tp_frame >> 9) & 1); // fold the data and parity bits together to count the ones
+  ones = ones ^ (ones >> 4);
+  ones = ones ^ (ones >> 2);
+  ones = ones ^ (ones >> 1);
+  if ((tp_frame & 0x0001) || !(tp_frame & 0x0400)) { // start bit s/b low and stop bit s/b high
+    tp_frame_errors++;
+    tp_rx_error = HIGH;
+  }
+  else if ((ones & 1) == 0) { // data plus parity s/b an odd number of ones
+    tp_parity_errors++;
+    tp_rx_error = HIGH;
+  }
+  else if (((tp_head + 1) & (TP_BUF_SIZE - 1)) == tp_tail) { // no room for the byte
+    tp_overruns++;
+    tp_rx_error = HIGH;
+  }
+  else {
+    tp_buf[tp_head] = data; // save the byte
+    tp_head = (tp_head + 1) & (TP_BUF_SIZE - 1);
+  }
+}
+// Function to check if a received touchpad byte is waiting in the ring buffer
+boolean tp_available()
+{
+  return (tp_head != tp_tail);
+}
+// Function to throw away any received touchpad bytes
+void tp_flush()
+{
+  tp_tail = tp_head;
+}
 // Function to send the Touchpad a command
 void tp_write(char send_data)  
 {
-  unsigned int timeout = 200; // breakout of loop if over this value in msec
+  unsigned int timeout = TP_WRITE_TIMEOUT; // breakout of loop if over this value in msec
   elapsedMillis watchdog; // zero the watchdog timer clock
   char odd_parity = 0; // clear parity bit count
+  uint8_t scan_on = TIMSK1 & (1 << OCIE1A); // the scan interrupt is put back the way it was at the end
+// Stop the interrupt from receiving while the Teensy drives the clock. A byte cut short by the request to send
+// is thrown away (the touchpad sends it again). The scan interrupt is also held off so the loops below can't miss
+// a clock edge, the keys it would have seen are picked up on the ticks after the write.
+  PCMSK0 = PCMSK0 & ~(1 << TP_CLK_PCINT);
+  TIMSK1 = TIMSK1 & ~(1 << OCIE1A);
+  tp_bit_count = 0;
+  tp_flush(); // anything received before the command can't be its reply
 // Enable the bus by floating the clock and data
   go_z(TP_CLK); //
   go_z(TP_DATA); //
@@ -282,101 +617,31 @@ void tp_write(char send_data)
       break; // break out of infinite loop
     }
   }
-// Inhibit the bus so the tp only talks when we're listening
-  go_0(TP_CLK);
+  if (watchdog >= timeout) { // one of the waits above timed out
+    tp_timeouts++;
+  }
+// Leave the bus released so the touchpad can send its reply. The interrupt receives it.
+  go_z(TP_CLK);
+  PCMSK0 = PCMSK0 | (1 << TP_CLK_PCINT);
+  TIMSK1 = TIMSK1 | scan_on;
 }
 //
-// Function to get a byte of data from the touchpad
+// Function to get a byte of data from the touchpad. The bits are received by the pin change interrupt, this waits
+// for a whole byte to be in the ring buffer.
 //
 char tp_read(void)
 {
-  unsigned int timeout = 200; // breakout of loop if over this value in msec
+  unsigned int timeout = TP_READ_TIMEOUT; // breakout of loop if over this value in msec
   elapsedMillis watchdog; // zero the watchdog timer clock
-  char rcv_data = 0; // initialize to zero
-  char mask = 1; // shift a 1 across the 8 bits to select where to load the data
-  char rcv_parity = 0; // count the ones received
-  go_z(TP_CLK); // release the clock
-  go_z(TP_DATA); // release the data
-  delayMicroseconds(5); // delay to let clock go high
-  while (digitalRead(TP_CLK) == HIGH) { // loop until the clock goes low
-    if (watchdog >= timeout) { //check for infinite loop
-      touchpad_error = HIGH; // set error flag       
-      break; // break out of infinite loop
-    }
-  }
-  if (digitalRead(TP_DATA)) { // Start bit s/b low from tp
-    touchpad_error = HIGH; // No start bit so set the error flag
-  }  
-  delayMicroseconds(1); // delay to let the clock settle out
-  while (digitalRead(TP_CLK) == LOW) { // loop until the clock goes high
-    if (watchdog >= timeout) { //check for infinite loop
-      touchpad_error = HIGH; // set error flag       
-      break; // break out of infinite loop
-    }
-  }
-  for (int k=0; k<8; k++) {  
-    delayMicroseconds(1); // delay to let the clock settle out
-    while (digitalRead(TP_CLK) == HIGH) { // loop until the clock goes low
-      if (watchdog >= timeout) { //check for infinite loop
-        touchpad_error = HIGH; // set error flag       
-        break; // break out of infinite loop
-      }
-    }
-    if (digitalRead(TP_DATA)) { // check if data is high
-      rcv_data = rcv_data | mask; // set the appropriate bit in the rcv data
-      rcv_parity++; // increment the parity bit counter
-    }
-    mask = mask << 1;
-    delayMicroseconds(1); // delay to let the clock settle out
-    while (digitalRead(TP_CLK) == LOW) { // loop until the clock goes high
-      if (watchdog >= timeout) { //check for infinite loop
-        touchpad_error = HIGH; // set error flag       
-        break; // break out of infinite loop
-      }
-    }
-  }
-// receive parity
-  delayMicroseconds(1); // delay to let the clock settle out
-  while (digitalRead(TP_CLK) == HIGH) { // loop until the clock goes low
+  while (!tp_available()) { // loop until the interrupt has received a byte
     if (watchdog >= timeout) { //check for infinite loop
       touchpad_error = HIGH; // set error flag       
-      break; // break out of infinite loop
+      tp_timeouts++;
+      return 0;
     }
   }
-  if (digitalRead(TP_DATA))  { // check if received parity is high
-    rcv_parity++; // increment the parity bit counter
-  }
-  rcv_parity = rcv_parity & 1; // mask off all bits except the lsb
-  if (rcv_parity == 0) { // check for bad (even) parity
-    touchpad_error = HIGH; //bad parity so set the error flag
-  } 
-  delayMicroseconds(1); // delay to let the clock settle out
-  while (digitalRead(TP_CLK) == LOW) { // loop until the clock goes high
-    if (watchdog >= timeout) { //check for infinite loop
-      touchpad_error = HIGH; // set error flag       
-      break; // break out of infinite loop
-    }
-  }
-// stop bit
-  delayMicroseconds(1); // delay to let the clock settle out
-  while (digitalRead(TP_CLK) == HIGH) { // loop until the clock goes low
-    if (watchdog >= timeout) { //check for infinite loop
-      touchpad_error = HIGH; // set error flag       
-      break; // break out of infinite loop
-    }
-  }
-  if (digitalRead(TP_DATA) == LOW) { // check if stop bit is bad (low)
-    touchpad_error = HIGH; //bad stop bit so set the error flag
-  }
-  delayMicroseconds(1); // delay to let the clock settle out
-  while (digitalRead(TP_CLK) == LOW) { // loop until the clock goes high
-    if (watchdog >= timeout) { //check for infinite loop
-      touchpad_error = HIGH; // set error flag       
-      break; // break out of infinite loop
-    }
-  }
-// Inhibit the bus so the tp only talks when we're listening
-  go_0(TP_CLK);
+  char rcv_data = tp_buf[tp_tail]; // take the oldest byte
+  tp_tail = (tp_tail + 1) & (TP_BUF_SIZE - 1);
   return rcv_data; // pass the received data back
 }
 // Function to initialize the Touchpad
@@ -385,6 +650,8 @@ void touchpad_init()
   touchpad_error = LOW; // start with no error
   go_z(TP_CLK); // float the clock and data to touchpad
   go_z(TP_DATA);
+  PCICR = PCICR | (1 << PCIE0); // enable the port B pin change interrupt (tp_write turns on the TP_CLK pin)
+  tp_flush(); // start with an empty receive buffer
   //  Sending reset command to touchpad
   tp_write(0xff);
   if (tp_read() != 0xfa) { // verify correct ack byte
@@ -407,11 +674,19 @@ void touchpad_init()
   if (tp_read() != 0xfa) { // verify correct ack byte
     touchpad_error = HIGH;
   }
-  //  Sending remote mode code so the touchpad will send data only when polled
-  tp_write(0xf0);  // remote mode 
+  //  Set the sample rate, then enable data reporting so the touchpad sends a packet each time it moves (stream mode)
+  tp_write(0xf3); // Sending sample rate command
   if (tp_read() != 0xfa) { // verify correct ack byte
     touchpad_error = HIGH;
-  } 
+  }
+  tp_write(TP_SAMPLE_RATE); // samples per second
+  if (tp_read() != 0xfa) { // verify correct ack byte
+    touchpad_error = HIGH;
+  }
+  tp_write(0xf4); // enable data reporting
+  if (tp_read() != 0xfa) { // verify correct ack byte
+    touchpad_error = HIGH;
+  }
   if (touchpad_error == HIGH) { // check for any errors from tp
     delayMicroseconds(300); // wait before trying to initialize tp one last time
     tp_write(0xff); // send tp reset code
@@ -422,57 +697,98 @@ void touchpad_init()
     tp_read();  // read but don't look at response from tp
     tp_write(0x03); // value of 03 gives 8 counts/mm resolution
     tp_read();  // read but don't look at response from tp
-    tp_write(0xf0);  // remote mode 
+    tp_write(0xf3); // Send sample rate command
+    tp_read();  // read but don't look at response from tp
+    tp_write(TP_SAMPLE_RATE); // samples per second
+    tp_read();  // read but don't look at response from tp
+    tp_write(0xf4); // enable data reporting
     tp_read();  // read but don't look at response from tp 
     delayMicroseconds(100);
   }
 }
-// Function to send the 4 keyboard modifier keys over usb
-void send_modifiers(int mod_shift, int mod_ctrl, int mod_alt, int mod_gui) {
-  Keyboard.set_modifier(mod_shift | mod_ctrl | mod_alt | mod_gui);
+// Function to send the modifier keys and the normal keys in the old_state bit map over usb as one report.
+// The keys go in the report in matrix order. If more than 6 are pressed every key code is ErrorRollOver,
+// which tells the host to keep the keys it has until some are released. A report that is the same as the
+// last one sent is skipped (for example a 7th and 8th key while in ErrorRollOver).
+uint8_t sent_keys[REPORT_KEYS] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}; // last report sent (0xff = nothing sent yet)
+uint8_t sent_modifiers = 0;
+uint16_t rollover_reports = 0; // reports sent as ErrorRollOver
+// Function to send a keyboard report unless it is the same as the last one. Returns LOW if it was skipped.
+boolean send_keys(uint8_t modifiers, const uint8_t *keys)
+{
+  if ((modifiers == sent_modifiers) && !memcmp(keys, sent_keys, REPORT_KEYS)) { // no change for the host
+    return LOW;
+  }
+  memcpy(sent_keys, keys, REPORT_KEYS);
+  sent_modifiers = modifiers;
+  Keyboard.set_modifier(modifiers);
+  Keyboard.set_key1(keys[0]);
+  Keyboard.set_key2(keys[1]);
+  Keyboard.set_key3(keys[2]);
+  Keyboard.set_key4(keys[3]);
+  Keyboard.set_key5(keys[4]);
+  Keyboard.set_key6(keys[5]);
   Keyboard.send_now();
+  return HIGH;
 }
-// Function to send the keyboard normal keys in the 6 slots over usb
-void send_normals(int slot1, int slot2, int slot3, int slot4, int slot5, int slot6) {
-  Keyboard.set_key1(slot1);
-  Keyboard.set_key2(slot2);
-  Keyboard.set_key3(slot3);
-  Keyboard.set_key4(slot4);
-  Keyboard.set_key5(slot5);
-  Keyboard.set_key6(slot6);
-  Keyboard.send_now();
+// Returns LOW if the report was skipped.
+boolean send_report(uint8_t modifiers) {
+  uint8_t keys[REPORT_KEYS] = {0, 0, 0, 0, 0, 0};
+  uint8_t count = 0;
+  for (uint8_t row = 0; row < NUM_ROWS; row++) {
+    uint8_t pressed = old_state[row];
+    for (uint8_t col = 0; pressed; col++) {
+      if (pressed & (1 << col)) {
+        pressed = pressed & ~(1 << col);
+        if (count < REPORT_KEYS) {
+          keys[count] = key_action[row * NUM_COLS + col] & 0xff; // usb usage code
+        }
+        count++;
+      }
+    }
+  }
+  if (count > REPORT_KEYS) {
+    for (uint8_t i = 0; i < REPORT_KEYS; i++) {
+      keys[i] = KEY_ERROR_ROLLOVER;
+    }
+  }
+  if (!send_keys(modifiers, keys)) {
+    return LOW;
+  }
+  if (count > REPORT_KEYS) {
+    rollover_reports++;
+  }
+  return HIGH;
 }
 // Function to initialize the keyboard
 void keyboard_init()
 {
-  pinMode(Col0, INPUT_PULLUP); // Configure the 8 keyboard columns with pullups
-  pinMode(Col1, INPUT_PULLUP);
-  pinMode(Col2, INPUT_PULLUP);
-  pinMode(Col3, INPUT_PULLUP);
-  pinMode(Col4, INPUT_PULLUP);
-  pinMode(Col5, INPUT_PULLUP);
-  pinMode(Col6, INPUT_PULLUP);
-  pinMode(Col7, INPUT_PULLUP);
-//
-  go_z(Row0); // Send all 16 rows to high impedance (the off state)
-  go_z(Row1);
-  go_z(Row2);
-  go_z(Row3);
-  go_z(Row4);
-  go_z(Row5);
-  go_z(Row6);
-  go_z(Row7);
-  go_z(Row8);
-  go_z(Row9);
-  go_z(Row10);
-  go_z(Row11);
-  go_z(Row12);
-  go_z(Row13);
-  go_z(Row14);
-  go_z(Row15);
-//
-  send_modifiers(0, 0, 0, 0); // tell the pi all mod keys are released
-  send_normals(0, 0, 0, 0, 0, 0); // tell the pi all normal keys are released
+  for (uint8_t col = 0; col < NUM_COLS; col++) {
+    pinMode(col_pins[col], INPUT_PULLUP); // Configure the 8 keyboard columns with pullups
+  }
+//
+  for (uint8_t row = 0; row < NUM_ROWS; row++) {
+    go_z(row_pins[row]); // Send all 16 rows to high impedance (the off state)
+#if defined(__AVR_AT90USB1286__)
+    row_ddr[row] = portModeRegister(digitalPinToPort(row_pins[row]));
+    row_port[row] = portOutputRegister(digitalPinToPort(row_pins[row]));
+    row_bit[row] = digitalPinToBitMask(row_pins[row]);
+#endif
+  }
+//
+  send_report(0); // tell the pi all keys are released
+//
+  scan_row_num = 0;
+  row_on(0); // the first tick reads row 0
+  TCCR1A = 0;
+  TCCR1B = 0;
+  OCR1A = ROW_TICKS - 1;
+  TCNT1 = 0;
+  unsigned long ms = millis();
+  while (millis() == ms) { // start on a millisecond edge so a pass is the matrix as it was in one millisecond
+  }
+  TCCR1B = (1 << WGM12) | (1 << CS11); // clear the count on a match with OCR1A, count at F_CPU / 8
+  TIMSK1 = (1 << OCIE1A); // start the scan interrupt
 }
 //  Function to initialize the lcd control interface
 void lcd_control_init()
@@ -489,37 +805,185 @@ void reset_shutdown_init()
   go_0(SHUTDOWN); // put shutdown signal in inactive state
   go_1(DISK_LED); // turn off disk led 
 }
-// Function to pulse the Menu key on the lcd control card
-void pulse_menu()
+// Timed pin actions. Each one sets a pin with go_0, go_1 or go_z when millis reaches its time.
+struct pin_action {
+  unsigned long at; // millis when the action is done
+  uint8_t pin;
+  uint8_t level; // GO_0, GO_1 or GO_Z
+};
+pin_action pin_actions[MAX_PIN_ACTIONS]; // queue of actions in the order they were added
+uint8_t num_pin_actions = 0; // number of actions in the queue
+//
+// Function to add a pin action to the queue. Returns LOW if the queue is full.
+boolean schedule_pin(uint8_t pin, uint8_t level, unsigned long at)
 {
-  go_0(Menu); //Pulse Menu key low
-  delay(200);
-  go_z(Menu);
-  delay(800);
+  if (num_pin_actions >= MAX_PIN_ACTIONS) {
+    return LOW;
+  }
+  pin_actions[num_pin_actions].at = at;
+  pin_actions[num_pin_actions].pin = pin;
+  pin_actions[num_pin_actions].level = level;
+  num_pin_actions++;
+  return HIGH;
 }
-// Function to pulse the Vol Up key on the lcd control card
-void pulse_vol_up()
+// Function to do the pin actions that are due and remove them from the queue
+void run_pin_actions()
 {
-  go_0(Vol_Up); //Pulse Vol_Up key low
-  delay(200);
-  go_z(Vol_Up);
-  delay(800);
+  unsigned long now = millis();
+  uint8_t i = 0;
+  while (i < num_pin_actions) {
+    if ((long)(now - pin_actions[i].at) >= 0) { // due
+      if (pin_actions[i].level == GO_0) {
+        go_0(pin_actions[i].pin);
+      }
+      else if (pin_actions[i].level == GO_1) {
+        go_1(pin_actions[i].pin);
+      }
+      else {
+        go_z(pin_actions[i].pin);
+      }
+      num_pin_actions--;
+      for (uint8_t j = i; j < num_pin_actions; j++) { // keep the rest in order
+        pin_actions[j] = pin_actions[j + 1];
+      }
+    }
+    else {
+      i++;
+    }
+  }
 }
-// Function to pulse the Vol_Dn key on the lcd control card
-void pulse_vol_dn()
+// An lcd macro is a list of steps kept in flash. Each step sets an lcd control pin and waits msec
+// before the next step. The steps are done by lcd_task so the keyboard keeps scanning.
+struct lcd_step {
+  uint8_t pin; // Vol_Up, Vol_Dn, Menu, On_Off or LCD_END
+  uint8_t level; // GO_0 or GO_Z (never GO_1, the card runs at 3.3 volts)
+  uint16_t msec; // wait after this step
+};
+// One push of a button on the lcd control card = 200 msec low, then wait 800 msec
+const lcd_step vol_up_macro[] PROGMEM = {
+  { Vol_Up, GO_0, 200 }, { Vol_Up, GO_Z, 800 },
+  { LCD_END, 0, 0 }
+};
+const lcd_step vol_dn_macro[] PROGMEM = {
+  { Vol_Dn, GO_0, 200 }, { Vol_Dn, GO_Z, 800 },
+  { LCD_END, 0, 0 }
+};
+// Fn & F2 = move thru the menus to toggle mute on/off, then wait until Menu screen goes away
+const lcd_step mute_macro[] PROGMEM = {
+  { Menu, GO_0, 200 },   { Menu, GO_Z, 800 },
+  { Vol_Up, GO_0, 200 }, { Vol_Up, GO_Z, 800 },
+  { Menu, GO_0, 200 },   { Menu, GO_Z, 800 },
+  { Vol_Dn, GO_0, 200 }, { Vol_Dn, GO_Z, 800 },
+  { Menu, GO_0, 200 },   { Menu, GO_Z, 800 },
+  { Vol_Dn, GO_0, 200 }, { Vol_Dn, GO_Z, 5800 },
+  { LCD_END, 0, 0 }
+};
+// Fn & F5 or F6 = move thru the menus to the brightness setting. Vol_Dn or Vol_Up then repeats while the key is held.
+const lcd_step brightness_macro[] PROGMEM = {
+  { Menu, GO_0, 200 }, { Menu, GO_Z, 800 },
+  { Menu, GO_0, 200 }, { Menu, GO_Z, 800 },
+  { Menu, GO_0, 200 }, { Menu, GO_Z, 800 },
+  { LCD_END, 0, 0 }
+};
+// Blink the display = pulse the display power button low for 100ms to turn it off, wait 300ms, and pulse it again
+const lcd_step blink_macro[] PROGMEM = {
+  { On_Off, GO_0, 100 }, { On_Off, GO_Z, 300 },
+  { On_Off, GO_0, 100 }, { On_Off, GO_Z, 0 },
+  { LCD_END, 0, 0 }
+};
+//
+// Lcd macro variables
+const lcd_step *lcd_queue[LCD_QUEUE_SIZE]; // macros waiting to run, oldest first
+uint8_t lcd_queue_first = 0; // location of the oldest macro in lcd_queue
+uint8_t lcd_queue_count = 0; // number of macros in lcd_queue
+const lcd_step *lcd_running = NULL; // next step of the macro being run, NULL when no macro is running
+unsigned long lcd_step_at; // millis when the next step is due
+uint8_t lcd_dropped = 0; // count of macros thrown away because the queue was full
+const lcd_step *repeat_macro = NULL; // macro to repeat while a key is held (Fn & F5, Fn & F6), NULL = none
+uint8_t repeat_row; // matrix location of the key
+uint8_t repeat_col;
+//
+// Function to add a macro to the end of the queue. Returns LOW if the queue is full.
+boolean lcd_start(const lcd_step *macro)
+{
+  if (lcd_queue_count >= LCD_QUEUE_SIZE) {
+    lcd_dropped++;
+    return LOW;
+  }
+  lcd_queue[(lcd_queue_first + lcd_queue_count) % LCD_QUEUE_SIZE] = macro;
+  lcd_queue_count++;
+  return HIGH;
+}
+// Function to repeat a macro while the key at row, col is held. The repeat starts when the queue is empty
+// and there is never more than one repeat waiting, so holding the key doesn't pile up pulses.
+void lcd_repeat(const lcd_step *macro, uint8_t row, uint8_t col)
 {
-  go_0(Vol_Dn); //Pulse Vol_Dn key low
-  delay(200);
-  go_z(Vol_Dn);
-  delay(800);
+  repeat_macro = macro;
+  repeat_row = row;
+  repeat_col = col;
+}
+// Lcd task: do the macro steps that are due
+void lcd_task()
+{
+  unsigned long now = millis();
+  for (;;) {
+    if (lcd_running == NULL) { // pick the next macro
+      if (lcd_queue_count) {
+        lcd_running = lcd_queue[lcd_queue_first];
+        lcd_queue_first = (lcd_queue_first + 1) % LCD_QUEUE_SIZE;
+        lcd_queue_count--;
+      }
+      else if (repeat_macro && ((key_down[repeat_row] >> repeat_col) & 1)) { // key still held
+        lcd_running = repeat_macro;
+      }
+      else {
+        repeat_macro = NULL;
+        return; // nothing to do
+      }
+      lcd_step_at = now;
+    }
+    if ((long)(now - lcd_step_at) < 0) { // wait for the step time
+      return;
+    }
+    uint8_t pin = pgm_read_byte(&lcd_running->pin);
+    if (pin == LCD_END) {
+      lcd_running = NULL;
+      continue;
+    }
+    if (pgm_read_byte(&lcd_running->level) == GO_0) {
+      go_0(pin);
+    }
+    else {
+      go_z(pin);
+    }
+    lcd_step_at = lcd_step_at + pgm_read_word(&lcd_running->msec); // time from the step before, so the steps don't drift
+    lcd_running++;
+  }
 }
 // Function to receive commands over i2c
-// Commands are: shutdown = 0x5a, reset = 0xb7, debug led on = 0x10, debug led off = 0x11, blink lcd = e2
+// Commands are: shutdown = 0x5a, reset = 0xb7, debug led on = 0x10, debug led off = 0x11, blink lcd = e2,
+// text mode reads = 0x30, binary mode reads = 0x31, clear the timing registers = 0x32.
+// A first byte below NUM_REGS, or in the timing window from REG_PERF, is the register number.
 void receiveEvent(int numBytes) {
   byte read_value;
   int i;
   for (i=0; i < numBytes; i++) {
     read_value = Wire.read();
+    if ((i == 0) && (read_value < NUM_REGS)) {
+      reg_pointer = read_value; // the next binary read starts at this register
+    }
+    if ((i == 0) && (read_value >= REG_PERF) && (read_value < REG_PERF + NUM_PERF_REGS)) {
+      reg_pointer = NUM_REGS + read_value - REG_PERF; // the timing registers follow the first window in i2c_regs
+    }
+    if (read_value == 0x30) {
+      binary_mode = LOW; // reads return the battery text
+    }
+    if (read_value == 0x31) {
+      binary_mode = HIGH; // reads return the register block
+    }
+    if (read_value == 0x32) {
+      clear_stats = HIGH; // the command task clears the timing registers
+    }
     if (read_value == 0x5a) {  
       kill_power = HIGH; // Send variable "true" for shutdown on next keyboard polling cycle
     }
@@ -538,211 +1002,87 @@ void receiveEvent(int numBytes) {
   }
 }
 // Function to send Battery voltage from ADC, Teensy code version number, date and author to Pi.
-// Formula for the ADC 10 bit code is below. All values read 22 bits lower than expected so there is a negative offset from something.
-// ADC 10 bit Result = [(Battery_voltage/4)/(5v/1023bits)] - 22 bits
+// In binary mode it sends the registers from reg_pointer to the end of its window instead, at most 16 registers
+// (a longer write would not fit the Wire buffer and nothing would be sent). The text and the registers are made
+// by the tasks so this interrupt routine only copies them.
 void requestEvent() {
-  if (adc_ave >= 0x345) {
-    Wire.write("Battery = 16.8v V3.2  7/7/18 MFA");
-  }
-  else if (adc_ave >= 0x340) {
-    Wire.write("Battery = 16.7v V3.2  7/7/18 MFA");
-  }
-  else if (adc_ave >= 0x33b) {
-    Wire.write("Battery = 16.6v V3.2  7/7/18 MFA");
-  }
-  else if (adc_ave >= 0x335) {
-    Wire.write("Battery = 16.5v V3.2  7/7/18 MFA");
-  }
-  else if (adc_ave >= 0x330) {
-    Wire.write("Battery = 16.4v V3.2  7/7/18 MFA");
-  }
-    else if (adc_ave >= 0x32b) {
-    Wire.write("Battery = 16.3v V3.2  7/7/18 MFA");
-  }
-    else if (adc_ave >= 0x326) {
-    Wire.write("Battery = 16.2v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x321) {
-    Wire.write("Battery = 16.1v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x31c) {
-    Wire.write("Battery = 16.0v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x317) {
-    Wire.write("Battery = 15.9v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x312) {
-    Wire.write("Battery = 15.8v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x30d) {
-    Wire.write("Battery = 15.7v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x307) {
-    Wire.write("Battery = 15.6v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x302) {
-    Wire.write("Battery = 15.5v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2fd) {
-    Wire.write("Battery = 15.4v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2f8) {
-    Wire.write("Battery = 15.3v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2f3) {
-    Wire.write("Battery = 15.2v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2ee) {
-    Wire.write("Battery = 15.1v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2e9) {
-    Wire.write("Battery = 15.0v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2e4) {
-    Wire.write("Battery = 14.9v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2df) {
-    Wire.write("Battery = 14.8v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2d9) {
-    Wire.write("Battery = 14.7v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2d4) {
-    Wire.write("Battery = 14.6v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2cf) {
-    Wire.write("Battery = 14.5v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2ca) {
-    Wire.write("Battery = 14.4v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2c5) {
-    Wire.write("Battery = 14.3v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2c0) {
-    Wire.write("Battery = 14.2v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2bb) {
-    Wire.write("Battery = 14.1v V3.2  7/7/18 MFA");
-  }    
-    else if (adc_ave >= 0x2b6) {
-    Wire.write("Battery = 14.0v V3.2  7/7/18 MFA");
-  }    
-    else {
-    Wire.write("Battery < 14.0v V3.2  7/7/18 MFA");
+  if (binary_mode) {
+    uint8_t end = (reg_pointer < NUM_REGS) ? NUM_REGS : NUM_REGS + NUM_PERF_REGS;
+    uint8_t count = end - reg_pointer;
+    if (count > I2C_READ_MAX / 2) {
+      count = I2C_READ_MAX / 2;
+    }
+    Wire.write((const uint8_t *)&i2c_regs[reg_pointer], count * 2); // the avr is little endian
+  }
+  else {
+    Wire.write(battery_text);
   }
 }
-// Setup the keyboard and touchpad. Float the lcd controls & pi reset. Drive the shutdown inactive.
-void setup() {
-  analogReference(EXTERNAL); // Configure ADC to use external 5 volt reference
-  reset_shutdown_init(); // initialize reset and shutdown signals
-  lcd_control_init(); // initialize lcd control signals
-  keyboard_init(); // initialize keyboard 
-  touchpad_init(); // initialize touchpad
-  if (touchpad_error) { // check for error
-    touchpad_init(); // try one more time to initialize the touchpad
-    if (touchpad_error) { 
-      touchpad_fail = HIGH; // touchpad failed to initialize
+// Timing of the scan loop phases. Each timed task, and each loop pass that ran a task, adds its run time here.
+struct phase_stats {
+  uint16_t min; // shortest run in usec
+  uint16_t max; // longest run in usec
+  uint32_t sum; // usec of the runs in count
+  uint16_t count; // runs in the average and histogram
+  uint16_t hist[HIST_BUCKETS]; // runs by time, bucket n is under 32 << n usec
+};
+phase_stats phases[NUM_PHASES];
+//
+// Function to add one run time to a phase
+void phase_record(uint8_t phase, unsigned long usec)
+{
+  phase_stats *p = &phases[phase];
+  uint16_t t = (usec > 0xffff) ? 0xffff : usec;
+  if ((p->count == 0) || (t < p->min)) {
+    p->min = t;
+  }
+  if (t > p->max) {
+    p->max = t;
+  }
+  if (p->count == PHASE_WINDOW) { // halve the old runs so the counts can't overflow
+    p->sum = p->sum >> 1;
+    p->count = p->count >> 1;
+    for (uint8_t b = 0; b < HIST_BUCKETS; b++) {
+      p->hist[b] = p->hist[b] >> 1;
     }
   }
-  Wire.begin(8);                // join i2c bus with address #8
-  Wire.onReceive(receiveEvent); // register event to receive command from Pi
-  Wire.onRequest(requestEvent); // register event to send info back to Pi
-    
+  p->sum = p->sum + t;
+  p->count++;
+  uint8_t b = 0;
+  for (uint16_t limit = 32; (b < HIST_BUCKETS - 1) && (t >= limit); limit = limit << 1) {
+    b++;
+  }
+  p->hist[b]++;
 }
 // Declare and Initialize Keyboard Variables
-boolean old_key_1 = HIGH; // old_key_ ... holds the state of every normal keyboard switch
-boolean old_key_2 = HIGH; // as it was on the previous scan. 
-boolean old_key_3 = HIGH; // Initialize all of the old_key_ ... variables to High (the off state).
-boolean old_key_4 = HIGH;
-boolean old_key_5 = HIGH;
-boolean old_key_6 = HIGH;
-boolean old_key_7 = HIGH;
-boolean old_key_8 = HIGH;
-boolean old_key_9 = HIGH;
-boolean old_key_0 = HIGH;
-boolean old_key_A = HIGH;
-boolean old_key_B = HIGH;
-boolean old_key_C = HIGH;
-boolean old_key_D = HIGH;
-boolean old_key_E = HIGH;
-boolean old_key_F = HIGH;
-boolean old_key_G = HIGH;
-boolean old_key_H = HIGH;
-boolean old_key_I = HIGH;
-boolean old_key_J = HIGH;
-boolean old_key_K = HIGH;
-boolean old_key_L = HIGH;
-boolean old_key_M = HIGH;
-boolean old_key_N = HIGH;
-boolean old_key_O = HIGH;
-boolean old_key_P = HIGH;
-boolean old_key_Q = HIGH;
-boolean old_key_R = HIGH;
-boolean old_key_S = HIGH;
-boolean old_key_T = HIGH;
-boolean old_key_U = HIGH;
-boolean old_key_V = HIGH;
-boolean old_key_W = HIGH;
-boolean old_key_X = HIGH;
-boolean old_key_Y = HIGH;
-boolean old_key_Z = HIGH;
-boolean old_key_LEFT = HIGH;
-boolean old_key_RIGHT = HIGH;
-boolean old_key_UP = HIGH;
-boolean old_key_DOWN = HIGH;
-boolean old_key_TILDE = HIGH;
-boolean old_key_MINUS = HIGH;
-boolean old_key_EQUAL = HIGH;
-boolean old_key_BACKSPACE = HIGH;
-boolean old_key_BACKSLASH = HIGH;
-boolean old_key_RIGHT_BRACE = HIGH;
-boolean old_key_LEFT_BRACE = HIGH;
-boolean old_key_ENTER = HIGH;
-boolean old_key_QUOTE = HIGH;
-boolean old_key_SEMICOLON = HIGH;
-boolean old_key_SLASH = HIGH;
-boolean old_key_PERIOD = HIGH;
-boolean old_key_COMMA = HIGH;
-boolean old_key_SPACE = HIGH;
-boolean old_key_CAPS_LOCK = HIGH;
-boolean old_key_TAB = HIGH;
-boolean old_key_ESC = HIGH;
-boolean old_key_PAGE_UP = HIGH;
-boolean old_key_PAGE_DOWN = HIGH;
-boolean old_key_END = HIGH;
-boolean old_key_HOME = HIGH;
-boolean old_key_INSERT = HIGH;
-boolean old_key_DELETE = HIGH;
-boolean old_key_PRINTSCREEN = HIGH;
-boolean old_key_F1 = HIGH;
-boolean old_key_F2 = HIGH;
-boolean old_key_F3 = HIGH;
-boolean old_key_F4 = HIGH;
-boolean old_key_F5 = HIGH;
-boolean old_key_F6 = HIGH;
-boolean old_key_F7 = HIGH;
-boolean old_key_F8 = HIGH;
-boolean old_key_F9 = HIGH;
-boolean old_key_F10 = HIGH;
-boolean old_key_F11 = HIGH;
-boolean old_key_F12 = HIGH;
-boolean old_key_MENU = HIGH; // the Menu key is not used in Teensyduino so it becomes the printscreen key
-//
-boolean old_key_SHIFT = HIGH; // old_key_ ... holds the state of every modifier keyboard switch
-boolean old_key_CTRL = HIGH; // Initialize all of the old_key_ ... variables to High (the off state).
-boolean old_key_ALT = HIGH;
-boolean old_key_GUI = HIGH;
-//
-boolean Fn_pressed = HIGH; // Active low, Saves the state of the Fn key 
+uint8_t modifiers = 0; // The SHIFT, CTRL, ALT and GUI modifier bits sent over usb
+uint8_t layer_on = 1; // layers in effect, bit n = layer n. The base layer is always on.
+uint8_t layer_lock = 0; // layers turned on by TG keys
+uint8_t tap_hold_key = NO_KEY; // tap/hold key not yet known to be a tap or a hold
+unsigned long tap_hold_ms; // millis() when it was pressed
+uint8_t tap_release_key = NO_KEY; // tapped key to release in the report after its press
+const uint16_t *key_macro = NULL; // macro step being typed, NULL when none
+boolean key_macro_down = LOW; // HIGH when the step's key has been sent pressed
 //
 boolean touchpad_enabled = HIGH; // Active high, controls whether the touchpad is used or not
+//
+// Usb report accumulator. Key and touchpad changes wait here until the usb task sends them.
+boolean kbd_report_pending = LOW; // HIGH when keys or modifiers changed since the last keyboard report
+uint8_t kbd_edges = 0; // key and modifier presses and releases waiting in the keyboard report
+unsigned long kbd_event_usec; // micros() of the scan that saw the oldest change in the pending report
+unsigned long kbd_report_ms; // millis() of the last keyboard report sent (one usb frame)
+int mouse_dx = 0; // touchpad movement waiting to be sent
+int mouse_dy = 0;
+boolean mouse_buttons_pending = LOW; // HIGH when the touchpad buttons changed since the last mouse report
+boolean mouse_left = 0; // touchpad button state to send
+boolean mouse_right = 0;
+uint8_t mouse_events = 0; // touchpad packets and button changes waiting in the mouse report
+uint16_t kbd_reports_sent = 0; // keyboard reports sent over usb
+uint16_t kbd_reports_saved = 0; // key and modifier changes that went out with another change instead of on their own
+uint16_t mouse_reports_sent = 0; // mouse reports sent over usb
+uint16_t mouse_reports_saved = 0; // touchpad packets and button changes that went out with another one
 boolean button_change = LOW; // Active high, shows when a touchpad left or right button has changed since last polling cycle
 //
-int mod_shift = 0; // These 4 variables are sent over USB as modifier keys.
-int mod_ctrl = 0; // Either set to 0 or MODIFIER_ ...   SHIFT, CTRL, ALT, GUI
-int mod_alt = 0;
-int mod_gui = 0;
 // Declare and Initialize Touchpad variables
 char mstat; // touchpad status reg = Y overflow, X overflow, Y sign bit, X sign bit, Always 1, Middle Btn, Right Btn, Left Btn
 char mx; // touchpad x movement = 8 data bits. The sign bit is in the status register to 
@@ -754,1244 +1094,521 @@ boolean right_button = 0; // on/off variable for right button = bit 1 of mstat
 boolean old_left_button = 0; // on/off variable for left button status from the previous polling cycle
 boolean old_right_button = 0; // on/off variable for right button status from the previous polling cycle
 //
-int blink_count = 0; // loop counter
+char tp_packet[3]; // stream mode packet = status, x and y
+uint8_t tp_packet_count = 0; // number of packet bytes received so far
+//
 boolean blinky = LOW; // Blink LED state
 //
 extern volatile uint8_t keyboard_leds; // 8 bits sent from Pi to Teensy that give keyboard LED status. Caps lock is bit D1.
 //
-// Main Loop scans the keyboard switches and then polls the touchpad 
-//
-void loop() {  
-// 
-// -------Scan keyboard matrix Rows 0 thru 15 & Columns 0 thru 7-------
-//
-// ------------------------------------------------------Row 15-----------------------------
-  go_0(Row15); // Activate Row (send it low), then read the column
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// ****************Fn Key***************************
-  //  Fn key is checked first so the Fn_pressed variable can be used later when the function keys are scanned
-  if (!digitalRead(Col0)) { // Check if Fn key is pressed
-    Fn_pressed = LOW; // Fn pressed
+// Function to count the bits that are set in a byte
+uint8_t count_bits(uint8_t bits)
+{
+  uint8_t count = 0;
+  while (bits) {
+    bits = bits & (bits - 1); // clear the lowest bit that is set
+    count++;
   }
-  else {
-    Fn_pressed = HIGH; // Fn not pressed  
-  }
-  go_z(Row15); // send row back to off state
-//
-// ------------------------------------------------------Row 0-----------------------------
-  go_0(Row0); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// ****************CTRL Key L and R***************************
-  //  Check if left or right control key is pressed and wasn't pressed last time
-  if ((!digitalRead(Col2) || (!digitalRead(Col6))) && (old_key_CTRL)) {
-    mod_ctrl = MODIFIERKEY_CTRL;
-    old_key_CTRL = LOW;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  } 
-  //  Check if left and right control keys are released and was pressed last time
-  else if (digitalRead(Col2) && digitalRead(Col6) && (!old_key_CTRL)) {
-    mod_ctrl = 0;
-    old_key_CTRL = HIGH;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  } 
-  go_z(Row0); // send row back to off state
-// ------------------------------------------------------Row 11-----------------------------
-  go_0(Row11); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// ****************SHIFT Key L and R***************************
-  //  Check if left or right shift key is pressed and wasn't pressed last time
-  if ((!digitalRead(Col5) || (!digitalRead(Col7))) && (old_key_SHIFT)) {
-    mod_shift = MODIFIERKEY_SHIFT;
-    old_key_SHIFT = LOW;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  }
-  //  Check if left and right shift keys are released and was pressed last time
-  else if (digitalRead(Col5) && digitalRead(Col7) && (!old_key_SHIFT)) {
-    mod_shift = 0;
-    old_key_SHIFT = HIGH;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  }
-  //
-  go_z(Row11); // send row back to off state
-// ------------------------------------------------------Row 13-----------------------------
-  go_0(Row13); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// ****************ALT Key L and R***************************
-  //  Check if left or right alt key is pressed and wasn't pressed last time
-  if ((!digitalRead(Col1) || (!digitalRead(Col3))) && (old_key_ALT)) {
-    mod_alt = MODIFIERKEY_ALT;
-    old_key_ALT = LOW;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  }
-  //  Check if left and right alt keys are released and was pressed last time
-  else if (digitalRead(Col1) && digitalRead(Col3) && (!old_key_ALT)) {
-    mod_alt = 0;
-    old_key_ALT = HIGH;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  }
-  //
-  go_z(Row13); // send row back to off state
-// ------------------------------------------------------Row 14-----------------------------
-  go_0(Row14); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// ****************GUI Key***************************
-  //  Check if gui key is pressed and wasn't pressed last time
-  if (!digitalRead(Col4) && (old_key_GUI)) {
-    mod_gui = MODIFIERKEY_GUI;
-    old_key_GUI = LOW;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  }
-  //  Check if gui key is released and was pressed last time
-  else if (digitalRead(Col4) && (!old_key_GUI)) {
-    mod_gui = 0;
-    old_key_GUI = HIGH;
-    send_modifiers(mod_shift, mod_ctrl, mod_alt, mod_gui); // use function to send 4 modifiers over usb
-  }   
-  go_z(Row14); // send row back to off state
-// --------------------------------------------------Row 1---------------------------------
-  go_0(Row1); // Activate Row (send it low), then read the columns
-//
-  delayMicroseconds(10); // give the row time to go low and settle out
-// *****************Left Arrow Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_LEFT && (!slots_full)) {
-    load_slot(KEY_LEFT); //update first available slot with key name
-    old_key_LEFT = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_LEFT) {
-    clear_slot(KEY_LEFT); // clear slot that contains key name
-    old_key_LEFT = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Down Arrow Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_DOWN && (!slots_full)) {
-    load_slot(KEY_DOWN); //update first available slot with key name
-    old_key_DOWN = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_DOWN) {
-    clear_slot(KEY_DOWN); // clear slot that contains key name
-    old_key_DOWN = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Up Arrow Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_UP && (!slots_full)) {
-    load_slot(KEY_UP); //update first available slot with key name
-    old_key_UP = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_UP) {
-    clear_slot(KEY_UP); // clear slot that contains key name
-    old_key_UP = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Page Down Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_PAGE_DOWN && (!slots_full)) {
-    load_slot(KEY_PAGE_DOWN); //update first available slot with key name
-    old_key_PAGE_DOWN = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_PAGE_DOWN) {
-    clear_slot(KEY_PAGE_DOWN); // clear slot that contains key name
-    old_key_PAGE_DOWN = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Page Up Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_PAGE_UP && (!slots_full)) {
-    load_slot(KEY_PAGE_UP); //update first available slot with key name
-    old_key_PAGE_UP = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_PAGE_UP) {
-    clear_slot(KEY_PAGE_UP); // clear slot that contains key name
-    old_key_PAGE_UP = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************End Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_END && (!slots_full)) {
-    load_slot(KEY_END); //update first available slot with key name
-    old_key_END = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_END) {
-    clear_slot(KEY_END); // clear slot that contains key name
-    old_key_END = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Right Arrow Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_RIGHT && (!slots_full)) {
-    load_slot(KEY_RIGHT); //update first available slot with key name
-    old_key_RIGHT = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_RIGHT) {
-    clear_slot(KEY_RIGHT); // clear slot that contains key name
-    old_key_RIGHT = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row1); // send row back to off state
-// ------------------------------------------------------Row 2-----------------------------
-  go_0(Row2); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************Enter Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_ENTER && (!slots_full)) {
-    load_slot(KEY_ENTER); //update first available slot with key name
-    old_key_ENTER = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_ENTER) {
-    clear_slot(KEY_ENTER); // clear slot that contains key name
-    old_key_ENTER = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Right Brace Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_RIGHT_BRACE && (!slots_full)) {
-    load_slot(KEY_RIGHT_BRACE); //update first available slot with key name
-    old_key_RIGHT_BRACE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_RIGHT_BRACE) {
-    clear_slot(KEY_RIGHT_BRACE); // clear slot that contains key name
-    old_key_RIGHT_BRACE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Equal Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_EQUAL && (!slots_full)) {
-    load_slot(KEY_EQUAL); //update first available slot with key name
-    old_key_EQUAL = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_EQUAL) {
-    clear_slot(KEY_EQUAL); // clear slot that contains key name
-    old_key_EQUAL = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Quote Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_QUOTE && (!slots_full)) {
-    load_slot(KEY_QUOTE); //update first available slot with key name
-    old_key_QUOTE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_QUOTE) {
-    clear_slot(KEY_QUOTE); // clear slot that contains key name
-    old_key_QUOTE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row2); // send row back to off state
-// ------------------------------------------------------Row 3-----------------------------
-  go_0(Row3); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F12 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and the Fn key is not pushed
-  if (!digitalRead(Col0) && old_key_F12 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F12); //update first available slot with key name
-    old_key_F12 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F12) {
-    clear_slot(KEY_F12); // clear slot that contains key name
-    old_key_F12 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if Fn and F12 keys are pushed
-  if (!digitalRead(Col0) && (!Fn_pressed)) {  
-    touchpad_enabled = !touchpad_enabled; // toggle touchpad on/off
-  }     
-    while (digitalRead(Col0) == LOW) // wait until F12 key is released
-    ; 
-// *****************Print Screen Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_PRINTSCREEN && (!slots_full)) {
-    load_slot(KEY_PRINTSCREEN); //update first available slot with key name
-    old_key_PRINTSCREEN = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_PRINTSCREEN) {
-    clear_slot(KEY_PRINTSCREEN); // clear slot that contains key name
-    old_key_PRINTSCREEN = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Slash Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_SLASH && (!slots_full)) {
-    load_slot(KEY_SLASH); //update first available slot with key name
-    old_key_SLASH = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_SLASH) {
-    clear_slot(KEY_SLASH); // clear slot that contains key name
-    old_key_SLASH = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Semicolon Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_SEMICOLON && (!slots_full)) {
-    load_slot(KEY_SEMICOLON); //update first available slot with key name
-    old_key_SEMICOLON = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_SEMICOLON) {
-    clear_slot(KEY_SEMICOLON); // clear slot that contains key name
-    old_key_SEMICOLON = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Left Brace Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_LEFT_BRACE && (!slots_full)) {
-    load_slot(KEY_LEFT_BRACE); //update first available slot with key name
-    old_key_LEFT_BRACE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_LEFT_BRACE) {
-    clear_slot(KEY_LEFT_BRACE); // clear slot that contains key name
-    old_key_LEFT_BRACE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************P Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_P && (!slots_full)) {
-    load_slot(KEY_P); //update first available slot with key name
-    old_key_P = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_P) {
-    clear_slot(KEY_P); // clear slot that contains key name
-    old_key_P = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************MINUS Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_MINUS && (!slots_full)) {
-    load_slot(KEY_MINUS); //update first available slot with key name
-    old_key_MINUS = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_MINUS) {
-    clear_slot(KEY_MINUS); // clear slot that contains key name
-    old_key_MINUS = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************BACKSPACE Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_BACKSPACE && (!slots_full)) {
-    load_slot(KEY_BACKSPACE); //update first available slot with key name
-    old_key_BACKSPACE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_BACKSPACE) {
-    clear_slot(KEY_BACKSPACE); // clear slot that contains key name
-    old_key_BACKSPACE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row3); // send row back to off state
-// ------------------------------------------------------Row 4-----------------------------
-  go_0(Row4); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************INSERT Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col0) && old_key_INSERT && (!slots_full)) {
-    load_slot(KEY_INSERT); //update first available slot with key name
-    old_key_INSERT = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_INSERT) {
-    clear_slot(KEY_INSERT); // clear slot that contains key name
-    old_key_INSERT = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************BACKSLASH Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_BACKSLASH && (!slots_full)) {
-    load_slot(KEY_BACKSLASH); //update first available slot with key name
-    old_key_BACKSLASH = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_BACKSLASH) {
-    clear_slot(KEY_BACKSLASH); // clear slot that contains key name
-    old_key_BACKSLASH = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************HOME Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_HOME && (!slots_full)) {
-    load_slot(KEY_HOME); //update first available slot with key name
-    old_key_HOME = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_HOME) {
-    clear_slot(KEY_HOME); // clear slot that contains key name
-    old_key_HOME = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************L Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_L && (!slots_full)) {
-    load_slot(KEY_L); //update first available slot with key name
-    old_key_L = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_L) {
-    clear_slot(KEY_L); // clear slot that contains key name
-    old_key_L = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************DELETE Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_DELETE && (!slots_full)) {
-    load_slot(KEY_DELETE); //update first available slot with key name
-    old_key_DELETE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_DELETE) {
-    clear_slot(KEY_DELETE); // clear slot that contains key name
-    old_key_DELETE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row4); // send row back to off state
-// ------------------------------------------------------Row 5-----------------------------
-  go_0(Row5); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F10 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col0) && old_key_F10 && (!slots_full)) {
-    load_slot(KEY_F10); //update first available slot with key name
-    old_key_F10 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F10) {
-    clear_slot(KEY_F10); // clear slot that contains key name
-    old_key_F10 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************COMMA Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_COMMA && (!slots_full)) {
-    load_slot(KEY_COMMA); //update first available slot with key name
-    old_key_COMMA = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_COMMA) {
-    clear_slot(KEY_COMMA); // clear slot that contains key name
-    old_key_COMMA = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************PERIOD Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_PERIOD && (!slots_full)) {
-    load_slot(KEY_PERIOD); //update first available slot with key name
-    old_key_PERIOD = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_PERIOD) {
-    clear_slot(KEY_PERIOD); // clear slot that contains key name
-    old_key_PERIOD = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************i Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_I && (!slots_full)) {
-    load_slot(KEY_I); //update first available slot with key name
-    old_key_I = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_I) {
-    clear_slot(KEY_I); // clear slot that contains key name
-    old_key_I = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************0 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_0 && (!slots_full)) {
-    load_slot(KEY_0); //update first available slot with key name
-    old_key_0 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_0) {
-    clear_slot(KEY_0); // clear slot that contains key name
-    old_key_0 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************9 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_9 && (!slots_full)) {
-    load_slot(KEY_9); //update first available slot with key name
-    old_key_9 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_9) {
-    clear_slot(KEY_9); // clear slot that contains key name
-    old_key_9 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************F Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_F && (!slots_full)) {
-    load_slot(KEY_F); //update first available slot with key name
-    old_key_F = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_F) {
-    clear_slot(KEY_F); // clear slot that contains key name
-    old_key_F = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************F11 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_F11 && (!slots_full)) {
-    load_slot(KEY_F11); //update first available slot with key name
-    old_key_F11 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_F11) {
-    clear_slot(KEY_F11); // clear slot that contains key name
-    old_key_F11 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row5); // send row back to off state
-// ------------------------------------------------------Row 6-----------------------------
-  go_0(Row6); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F8 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col0) && old_key_F8 && (!slots_full)) {
-    load_slot(KEY_F8); //update first available slot with key name
-    old_key_F8 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F8) {
-    clear_slot(KEY_F8); // clear slot that contains key name
-    old_key_F8 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************M Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_M && (!slots_full)) {
-    load_slot(KEY_M); //update first available slot with key name
-    old_key_M = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_M) {
-    clear_slot(KEY_M); // clear slot that contains key name
-    old_key_M = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************B Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_B && (!slots_full)) {
-    load_slot(KEY_B); //update first available slot with key name
-    old_key_B = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_B) {
-    clear_slot(KEY_B); // clear slot that contains key name
-    old_key_B = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************8 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_8 && (!slots_full)) {
-    load_slot(KEY_8); //update first available slot with key name
-    old_key_8 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_8) {
-    clear_slot(KEY_8); // clear slot that contains key name
-    old_key_8 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************U Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_U && (!slots_full)) {
-    load_slot(KEY_U); //update first available slot with key name
-    old_key_U = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_U) {
-    clear_slot(KEY_U); // clear slot that contains key name
-    old_key_U = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************O Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_O && (!slots_full)) {
-    load_slot(KEY_O); //update first available slot with key name
-    old_key_O = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_O) {
-    clear_slot(KEY_O); // clear slot that contains key name
-    old_key_O = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************J Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_J && (!slots_full)) {
-    load_slot(KEY_J); //update first available slot with key name
-    old_key_J = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_J) {
-    clear_slot(KEY_J); // clear slot that contains key name
-    old_key_J = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************F9 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_F9 && (!slots_full)) {
-    load_slot(KEY_F9); //update first available slot with key name
-    old_key_F9 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_F9) {
-    clear_slot(KEY_F9); // clear slot that contains key name
-    old_key_F9 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row6); // send row back to off state
-// ------------------------------------------------------Row 7-----------------------------
-  go_0(Row7); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F7 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and the Fn key is not pushed
-  if (!digitalRead(Col0) && old_key_F7 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F7); //update first available slot with key name
-    old_key_F7 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F7) {
-    clear_slot(KEY_F7); // clear slot that contains key name
-    old_key_F7 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-   // Check if Fn and F7 keys are pressed
-  if (!digitalRead(Col0) && (!Fn_pressed)) {  // send On_Off low then send back to high Z
-    go_0(On_Off);
-    while (!digitalRead(Col0)) // wait until F7 key is released
-    ;
-    go_z(On_Off);
-  } 
-// *****************N Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_N && (!slots_full)) {
-    load_slot(KEY_N); //update first available slot with key name
-    old_key_N = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_N) {
-    clear_slot(KEY_N); // clear slot that contains key name
-    old_key_N = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************G Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_G && (!slots_full)) {
-    load_slot(KEY_G); //update first available slot with key name
-    old_key_G = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_G) {
-    clear_slot(KEY_G); // clear slot that contains key name
-    old_key_G = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Y Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_Y && (!slots_full)) {
-    load_slot(KEY_Y); //update first available slot with key name
-    old_key_Y = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_Y) {
-    clear_slot(KEY_Y); // clear slot that contains key name
-    old_key_Y = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************K Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_K && (!slots_full)) {
-    load_slot(KEY_K); //update first available slot with key name
-    old_key_K = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_K) {
-    clear_slot(KEY_K); // clear slot that contains key name
-    old_key_K = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************7 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_7 && (!slots_full)) {
-    load_slot(KEY_7); //update first available slot with key name
-    old_key_7 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_7) {
-    clear_slot(KEY_7); // clear slot that contains key name
-    old_key_7 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************H Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_H && (!slots_full)) {
-    load_slot(KEY_H); //update first available slot with key name
-    old_key_H = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_H) {
-    clear_slot(KEY_H); // clear slot that contains key name
-    old_key_H = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************6 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_6 && (!slots_full)) {
-    load_slot(KEY_6); //update first available slot with key name
-    old_key_6 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_6) {
-    clear_slot(KEY_6); // clear slot that contains key name
-    old_key_6 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row7); // send row back to off state
-// ------------------------------------------------------Row 8-----------------------------
-  go_0(Row8); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F5 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and Fn not pressed
-  if (!digitalRead(Col0) && old_key_F5 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F5); //update first available slot with key name
-    old_key_F5 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F5) {
-    clear_slot(KEY_F5); // clear slot that contains key name
-    old_key_F5 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if Fn and F5 keys are pushed for Brightness decrease
-  if (!digitalRead(Col0) && (!Fn_pressed)) { // move thru the menus to decrease brightness
-    pulse_menu();
-    pulse_menu();
-    pulse_menu();
-    while (!digitalRead(Col0)) { // repeat until F5 key is released
-      pulse_vol_dn();
+  return count;
+}
+// Function to debounce the 8 keys of a row. raw is the column read with bit n set if Col n is pressed.
+// The 8 counters are counted all at once with logic operations on the 4 counter bytes.
+void debounce_row(uint8_t row, uint8_t raw)
+{
+  uint8_t c0 = deb_cnt0[row];
+  uint8_t c1 = deb_cnt1[row];
+  uint8_t c2 = deb_cnt2[row];
+  uint8_t c3 = deb_cnt3[row];
+#if DEBOUNCE_MODE == DEBOUNCE_EAGER
+  // The counters hold the scans left before a key can change again. Count down the keys that are not zero.
+  uint8_t locked = c0 | c1 | c2 | c3;
+  uint8_t borrow0 = locked & ~c0;
+  uint8_t borrow1 = borrow0 & ~c1;
+  uint8_t borrow2 = borrow1 & ~c2;
+  c0 = c0 ^ locked;
+  c1 = c1 ^ borrow0;
+  c2 = c2 ^ borrow1;
+  c3 = c3 ^ borrow2;
+  // A key that changed and isn't locked out is changed right away and locked out
+  uint8_t toggle = (raw ^ key_state[row]) & ~locked;
+  c0 = (c0 & ~toggle) | ((DEBOUNCE_SCANS & 1) ? toggle : 0);
+  c1 = (c1 & ~toggle) | ((DEBOUNCE_SCANS & 2) ? toggle : 0);
+  c2 = (c2 & ~toggle) | ((DEBOUNCE_SCANS & 4) ? toggle : 0);
+  c3 = (c3 & ~toggle) | ((DEBOUNCE_SCANS & 8) ? toggle : 0);
+#else
+  // The counters hold the number of scans in a row that a key has read different than key_state
+  uint8_t delta = raw ^ key_state[row];
+  c3 = (c3 ^ (c2 & c1 & c0)) & delta; // add 1 to the keys that differ, clear the rest
+  c2 = (c2 ^ (c1 & c0)) & delta;
+  c1 = (c1 ^ c0) & delta;
+  c0 = ~c0 & delta;
+  // The keys that have differed for DEBOUNCE_SCANS scans are changed
+  uint8_t toggle = delta & ((DEBOUNCE_SCANS & 1) ? c0 : ~c0) & ((DEBOUNCE_SCANS & 2) ? c1 : ~c1)
+                         & ((DEBOUNCE_SCANS & 4) ? c2 : ~c2) & ((DEBOUNCE_SCANS & 8) ? c3 : ~c3);
+  c0 = c0 & ~toggle;
+  c1 = c1 & ~toggle;
+  c2 = c2 & ~toggle;
+  c3 = c3 & ~toggle;
+#endif
+  key_state[row] = key_state[row] ^ toggle;
+  deb_cnt0[row] = c0;
+  deb_cnt1[row] = c1;
+  deb_cnt2[row] = c2;
+  deb_cnt3[row] = c3;
+}
+// Function to debounce a row into key_state and put its changes in the key event queue. If the queue can't hold
+// all of the row's changes the row is put back as it was, so the changes are seen again on the next scan instead
+// of being lost. The events get the micros() time of the scan, which is only read when the row changed.
+void scan_row(uint8_t row, uint8_t raw)
+{
+  uint8_t before = key_state[row];
+  uint8_t c0 = deb_cnt0[row];
+  uint8_t c1 = deb_cnt1[row];
+  uint8_t c2 = deb_cnt2[row];
+  uint8_t c3 = deb_cnt3[row];
+  debounce_row(row, raw);
+  uint8_t changed = key_state[row] ^ before;
+  if (!changed) {
+    return;
+  }
+  uint8_t head = key_event_head;
+  uint8_t room = (key_event_tail - head - 1) & (KEY_EVENT_SIZE - 1);
+  if (count_bits(changed) > room) {
+    key_state[row] = before;
+    deb_cnt0[row] = c0;
+    deb_cnt1[row] = c1;
+    deb_cnt2[row] = c2;
+    deb_cnt3[row] = c3;
+    key_queue_full++;
+    return;
+  }
+  unsigned long usec = micros();
+  for (uint8_t col = 0; changed; col++) {
+    uint8_t mask = 1 << col;
+    if (changed & mask) {
+      changed = changed & ~mask;
+      key_events[head].key = (row * NUM_COLS + col) | ((key_state[row] & mask) ? KEY_EVENT_PRESS : 0);
+      key_events[head].usec = usec;
+      head = (head + 1) & (KEY_EVENT_SIZE - 1);
     }
-  } 
-// *****************V Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_V && (!slots_full)) {
-    load_slot(KEY_V); //update first available slot with key name
-    old_key_V = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_V) {
-    clear_slot(KEY_V); // clear slot that contains key name
-    old_key_V = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************S Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_S && (!slots_full)) {
-    load_slot(KEY_S); //update first available slot with key name
-    old_key_S = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_S) {
-    clear_slot(KEY_S); // clear slot that contains key name
-    old_key_S = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************T Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_T && (!slots_full)) {
-    load_slot(KEY_T); //update first available slot with key name
-    old_key_T = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_T) {
-    clear_slot(KEY_T); // clear slot that contains key name
-    old_key_T = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************R Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_R && (!slots_full)) {
-    load_slot(KEY_R); //update first available slot with key name
-    old_key_R = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_R) {
-    clear_slot(KEY_R); // clear slot that contains key name
-    old_key_R = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************5 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_5 && (!slots_full)) {
-    load_slot(KEY_5); //update first available slot with key name
-    old_key_5 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_5) {
-    clear_slot(KEY_5); // clear slot that contains key name
-    old_key_5 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************C Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_C && (!slots_full)) {
-    load_slot(KEY_C); //update first available slot with key name
-    old_key_C = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_C) {
-    clear_slot(KEY_C); // clear slot that contains key name
-    old_key_C = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************F6 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and Fn not pressed
-  if (!digitalRead(Col7) && old_key_F6 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F6); //update first available slot with key name
-    old_key_F6 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_F6) {
-    clear_slot(KEY_F6); // clear slot that contains key name
-    old_key_F6 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-    // Check if Fn and F6 keys are pushed for Brightness increase
-  if (!digitalRead(Col7) && (!Fn_pressed)) { // move thru the menus to get to the brightness adjust
-    pulse_menu();
-    pulse_menu();
-    pulse_menu();
-    while (!digitalRead(Col7)) { // repeat until F6 key is released
-      pulse_vol_up(); //Pulse Vol_Up low to Increase brightness
+  }
+  key_event_head = head; // the events are only seen once they are all written
+}
+// Timer 1 compare interrupt, one row of the keyboard matrix per tick. The row driven low on the last tick has had a
+// whole tick to settle, so its columns are read, then it goes back to the off state and the next row is driven low.
+// The touchpad clock interrupt is let in once the rows are switched, so a long tick (a row with many changes) can't
+// make it miss a clock low time. The scan's own interrupt stays off until the end so a tick never runs inside one.
+// The time from the timer match to the end of the tick is taken from the timer count, the longest of each pass is
+// recorded by the keyboard task.
+ISR(TIMER1_COMPA_vect)
+{
+  uint8_t row = scan_row_num;
+  uint8_t raw = read_columns();
+  row_off(row); // send row back to off state
+  uint8_t next = row + 1;
+  if (next == NUM_ROWS) {
+    next = 0;
+  }
+  row_on(next); // Activate the next row (send it low), it is read on the next tick
+  TIMSK1 = TIMSK1 & ~(1 << OCIE1A);
+  interrupts();
+  scan_row(row, raw);
+  noInterrupts();
+  TIMSK1 = TIMSK1 | (1 << OCIE1A);
+  scan_row_num = next;
+  uint16_t ticks = TCNT1;
+  if (ticks > scan_ticks_max) {
+    scan_ticks_max = ticks;
+  }
+  if (next == 0) { // the whole matrix has been read, its events can be reported
+    key_event_pass = key_event_head;
+    scan_pass_ticks = scan_ticks_max;
+    scan_ticks_max = 0;
+    scan_passes++;
+  }
+}
+// Function to check if a key has been sent over usb as pressed
+boolean key_reported(uint16_t key)
+{
+  for (uint8_t row = 0; row < NUM_ROWS; row++) {
+    for (uint8_t col = 0; col < NUM_COLS; col++) {
+      if ((key_action[row * NUM_COLS + col] == key) && ((old_state[row] >> col) & 1)) {
+        return HIGH;
+      }
     }
-  }   
-  go_z(Row8); // send row back to off state
-// ------------------------------------------------------Row 9-----------------------------
-  go_0(Row9); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F3 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and the Fn key is not pushed
-  if (!digitalRead(Col0) && old_key_F3 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F3); //update first available slot with key name
-    old_key_F3 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F3) {
-    clear_slot(KEY_F3); // clear slot that contains key name
-    old_key_F3 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if Fn and F3 keys are pushed
-  if (!digitalRead(Col0) && (!Fn_pressed)) {  // send volumn down low then send back to high Z
+  }
+  return LOW;
+}
+// Function to start a laptop control when its key is pressed. row and col are the key, for the controls
+// that repeat while it is held.
+void control_press(uint8_t control, uint8_t row, uint8_t col)
+{
+  switch (control) {
+    case CTL_MENU: // Send menu low until the key is released, then send back to high Z
+      go_0(Menu);
+      break;
+    case CTL_MUTE: // move thru the menus to toggle mute on/off
+      lcd_start(mute_macro);
+      break;
+    case CTL_VOL_DN: // Send volume down low until the key is released, then send back to high Z
       go_0(Vol_Dn);
-      while (digitalRead(Col0) == LOW) // wait until F3 key is released
-      ;
-      delay(1);  // wait for switch bounce to end
-      go_z(Vol_Dn);
-  } 
-// *****************X Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_X && (!slots_full)) {
-    load_slot(KEY_X); //update first available slot with key name
-    old_key_X = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_X) {
-    clear_slot(KEY_X); // clear slot that contains key name
-    old_key_X = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************E Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_E && (!slots_full)) {
-    load_slot(KEY_E); //update first available slot with key name
-    old_key_E = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_E) {
-    clear_slot(KEY_E); // clear slot that contains key name
-    old_key_E = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************4 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_4 && (!slots_full)) {
-    load_slot(KEY_4); //update first available slot with key name
-    old_key_4 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_4) {
-    clear_slot(KEY_4); // clear slot that contains key name
-    old_key_4 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************3 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_3 && (!slots_full)) {
-    load_slot(KEY_3); //update first available slot with key name
-    old_key_3 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_3) {
-    clear_slot(KEY_3); // clear slot that contains key name
-    old_key_3 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************D Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_D && (!slots_full)) {
-    load_slot(KEY_D); //update first available slot with key name
-    old_key_D = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_D) {
-    clear_slot(KEY_D); // clear slot that contains key name
-    old_key_D = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************F4 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and the Fn key is not pushed
-  if (!digitalRead(Col7) && old_key_F4 && (!slots_full) && Fn_pressed)  {
-    load_slot(KEY_F4); //update first available slot with key name
-    old_key_F4 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_F4) {
-    clear_slot(KEY_F4); // clear slot that contains key name
-    old_key_F4 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if Fn and F4 keys are pushed
-    if (!digitalRead(Col7) && (!Fn_pressed)) {  // send volumn up low then send back to high Z
+      break;
+    case CTL_VOL_UP: // Send volume up low until the key is released, then send back to high Z
       go_0(Vol_Up);
-      while (digitalRead(Col7) == LOW) // wait until F4 key is released
-      ;
-      delay(1);  // wait for switch bounce to end
+      break;
+    case CTL_BRIGHT_DN: // move thru the menus to decrease brightness
+      lcd_start(brightness_macro);
+      lcd_repeat(vol_dn_macro, row, col); // pulse Vol_Dn after the menus until the key is released
+      break;
+    case CTL_BRIGHT_UP: // move thru the menus to increase brightness
+      lcd_start(brightness_macro);
+      lcd_repeat(vol_up_macro, row, col); // pulse Vol_Up to Increase brightness after the menus until the key is released
+      break;
+    case CTL_ON_OFF: // Send On_Off low until the key is released, then send back to high Z
+      go_0(On_Off);
+      break;
+    case CTL_TOUCHPAD: // toggle touchpad on/off (once per press, holding the key does nothing more)
+      touchpad_enabled = !touchpad_enabled;
+      break;
+  }
+}
+// Function to finish a laptop control when its key is released. The release counts even if the layer key was
+// let go first, so a control line is never left low.
+void control_release(uint8_t control)
+{
+  switch (control) {
+    case CTL_MENU: // Menu back to high Z
+      go_z(Menu);
+      break;
+    case CTL_VOL_DN: // Vol_Dn back to high Z
+      go_z(Vol_Dn);
+      break;
+    case CTL_VOL_UP: // Vol_Up back to high Z
       go_z(Vol_Up);
+      break;
+    case CTL_ON_OFF: // On_Off back to high Z
+      go_z(On_Off);
+      break;
   }
-  go_z(Row9); // send row back to off state
-// ------------------------------------------------------Row 10-----------------------------
-  go_0(Row10); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// *****************F1 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and the Fn key is not pushed
-  if (!digitalRead(Col0) && old_key_F1 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F1); //update first available slot with key name
-    old_key_F1 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_F1) {
-    clear_slot(KEY_F1); // clear slot that contains key name
-    old_key_F1 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if Fn and F1 keys are pressed
-  if (!digitalRead(Col0) && (!Fn_pressed)) {  // send menu low then send back to high Z
-    go_0(Menu);
-    while (digitalRead(Col0) == LOW) // wait until F1 key is released
-    ;
-    go_z(Menu);
-  } 
-// *****************Z Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col1) && old_key_Z && (!slots_full)) {
-    load_slot(KEY_Z); //update first available slot with key name
-    old_key_Z = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col1) && !old_key_Z) {
-    clear_slot(KEY_Z); // clear slot that contains key name
-    old_key_Z = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************SPACE Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_SPACE && (!slots_full)) {
-    load_slot(KEY_SPACE); //update first available slot with key name
-    old_key_SPACE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_SPACE) {
-    clear_slot(KEY_SPACE); // clear slot that contains key name
-    old_key_SPACE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************Q Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col3) && old_key_Q && (!slots_full)) {
-    load_slot(KEY_Q); //update first available slot with key name
-    old_key_Q = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col3) && !old_key_Q) {
-    clear_slot(KEY_Q); // clear slot that contains key name
-    old_key_Q = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************2 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_2 && (!slots_full)) {
-    load_slot(KEY_2); //update first available slot with key name
-    old_key_2 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_2) {
-    clear_slot(KEY_2); // clear slot that contains key name
-    old_key_2 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// *****************1 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_1 && (!slots_full)) {
-    load_slot(KEY_1); //update first available slot with key name
-    old_key_1 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col5) && !old_key_1) {
-    clear_slot(KEY_1); // clear slot that contains key name
-    old_key_1 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// ****************W Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col6) && old_key_W && (!slots_full)) {
-    load_slot(KEY_W); //update first available slot with key name
-    old_key_W = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col6) && !old_key_W) {
-    clear_slot(KEY_W); // clear slot that contains key name
-    old_key_W = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// ****************F2 Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty and the Fn key is not pressed
-  if (!digitalRead(Col7) && old_key_F2 && (!slots_full) && Fn_pressed) {
-    load_slot(KEY_F2); //update first available slot with key name
-    old_key_F2 = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time 
-  else if (digitalRead(Col7) && !old_key_F2) {
-    clear_slot(KEY_F2); // clear slot that contains key name
-    old_key_F2 = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if Fn and F2 keys are pushed for Mute on/off
-  if (!digitalRead(Col7) && (!Fn_pressed)) { // move thru the menus to toggle mute on/off
-    pulse_menu();
-    pulse_vol_up();
-    pulse_menu();
-    pulse_vol_dn();
-    pulse_menu();
-    pulse_vol_dn();
-    delay(5000); // Wait until Menu screen goes away  
-  } 
-  go_z(Row10); // send row back to off state
-// ------------------------------------------------------Row 12-----------------------------
-  go_0(Row12); // Activate Row (send it low), then read the columns
-  //
-  delayMicroseconds(10); // give time to let the signals settle out
-  //
-// ****************TILDE Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col0) && old_key_TILDE && (!slots_full)) {
-    load_slot(KEY_TILDE); //update first available slot with key name
-    old_key_TILDE = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col0) && !old_key_TILDE) {
-    clear_slot(KEY_TILDE); // clear slot that contains key name
-    old_key_TILDE = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// ****************A Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col2) && old_key_A && (!slots_full)) {
-    load_slot(KEY_A); //update first available slot with key name
-    old_key_A = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col2) && !old_key_A) {
-    clear_slot(KEY_A); // clear slot that contains key name
-    old_key_A = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// ****************TAB Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col4) && old_key_TAB && (!slots_full)) {
-    load_slot(KEY_TAB); //update first available slot with key name
-    old_key_TAB = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col4) && !old_key_TAB) {
-    clear_slot(KEY_TAB); // clear slot that contains key name
-    old_key_TAB = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-// ****************CAPS LOCK Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col5) && old_key_CAPS_LOCK && (!slots_full)) {
-    load_slot(KEY_CAPS_LOCK); //update first available slot with key name
-    old_key_CAPS_LOCK = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-    delay(10); // wait for pi to send back led status update
-  }
-  // Check if key is released and was pressed last time
-  if (digitalRead(Col5) && !old_key_CAPS_LOCK) {
-    clear_slot(KEY_CAPS_LOCK); // clear slot that contains key name
-    old_key_CAPS_LOCK = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-    delay(10); // wait for pi to send back led status update
-   }
-// ****************ESC Key***************************
-  // Check if key is pressed and wasn't pressed last time and a usb slot is empty
-  if (!digitalRead(Col7) && old_key_ESC && (!slots_full)) {
-    load_slot(KEY_ESC); //update first available slot with key name
-    old_key_ESC = LOW; //remember key is now pressed
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  // Check if key is released and was pressed last time
-  else if (digitalRead(Col7) && !old_key_ESC) {
-    clear_slot(KEY_ESC); // clear slot that contains key name
-    old_key_ESC = HIGH; // remember key is now released
-    send_normals(slot1, slot2, slot3, slot4, slot5, slot6); // use function to send 6 slots over usb
-  }
-  go_z(Row12); // send row back to off state
-// -------------------------------------------------Keyboard scan complete------------------------------------------
-//
-// 
-// --------------------------------------Poll the touchpad for new movement data and button pushes----------------------------------
-//
-if (touchpad_fail == LOW) {  //skip touchpad section if it failed to initialize (allows keyboard to keep working)
-  over_flow = 0; // assume no overflow until status is received 
-  touchpad_error = LOW; // start with no error
-  tp_write(0xeb);  // "eb" = request data
-  if (tp_read() != 0xfa) { // verify correct ack byte
-    touchpad_error = HIGH;
+}
+// Function to find the action of a key from the highest active layer that doesn't pass it down
+uint16_t layer_action(uint8_t key)
+{
+  uint16_t action = pgm_read_word(&keymap[0][key]);
+  for (uint8_t layer = NUM_LAYERS - 1; layer > 0; layer--) {
+    if (layer_on & (1 << layer)) {
+      uint16_t layer_act = pgm_read_word(&keymap[layer][key]);
+      if (layer_act != TRANS) {
+        action = layer_act;
+        break;
+      }
+    }
+  }
+  if (((action & ACT_KIND) == ACT_MOD) && (action & ACT_MOD_PAGE)) {
+    action = 0; // a media or system key, not a modifier
+  }
+  return action;
+}
+// Function to put the modifier bits and the layers together from the keys held as modifiers and layers.
+// Adds the modifier changes to kbd_edges.
+void update_special()
+{
+  uint8_t new_modifiers = 0;
+  uint8_t layers = 1 | layer_lock;
+  for (uint8_t row = 0; row < NUM_ROWS; row++) {
+    uint8_t held = special_state[row];
+    for (uint8_t col = 0; held; col++) {
+      if (held & (1 << col)) {
+        held = held & ~(1 << col);
+        uint16_t action = key_action[row * NUM_COLS + col];
+        if ((action & ACT_KIND) == ACT_MOD) {
+          new_modifiers = new_modifiers | (action & 0xff);
+        }
+        else { // ACT_MO
+          layers = layers | (1 << (action & 0x0f));
+        }
+      }
+    }
+  }
+  kbd_edges = kbd_edges + count_bits(new_modifiers ^ modifiers); // modifier keys pressed or released
+  modifiers = new_modifiers;
+  layer_on = layers;
+}
+// Function to put a key in the keyboard report (press) or take it out
+void report_key(uint8_t key, boolean press)
+{
+  uint8_t row = key / NUM_COLS;
+  uint8_t mask = 1 << (key % NUM_COLS);
+  if (press) {
+    old_state[row] = old_state[row] | mask;
+  }
+  else {
+    old_state[row] = old_state[row] & ~mask;
+  }
+  kbd_edges++;
+}
+// Function to hold a key as a modifier or layer key, or let it go
+void special_key(uint8_t key, boolean press)
+{
+  uint8_t row = key / NUM_COLS;
+  uint8_t mask = 1 << (key % NUM_COLS);
+  if (press) {
+    special_state[row] = special_state[row] | mask;
+  }
+  else {
+    special_state[row] = special_state[row] & ~mask;
+  }
+  update_special();
+}
+// Function to make the waiting tap/hold key a hold: its layer or modifier is on until it is released
+void tap_hold_to_hold()
+{
+  uint8_t key = tap_hold_key;
+  uint16_t action = key_action[key];
+  tap_hold_key = NO_KEY;
+  if ((action & ACT_KIND) == ACT_LT) {
+    key_action[key] = ACT_MO | ((action >> 8) & 0x0f);
+  }
+  else { // ACT_MT
+    key_action[key] = ACT_MOD | ((action >> 8) & 0x0f);
+  }
+  special_key(key, HIGH);
+}
+// Function to decide the waiting tap/hold key when another key was pressed after it (permissive hold). It is a
+// tap if it is let go first, and its release is moved ahead of the keys pressed after it so they follow the tap
+// (rolling from Space into the next letter keeps the space). It is a hold if one of those keys is pressed and let
+// go while it is held. Returns LOW if the queue doesn't tell yet, then TAP_HOLD_MS makes it a hold.
+boolean tap_hold_decide(uint8_t tail, uint8_t pass)
+{
+  for (uint8_t i = tail; i != pass; i = (i + 1) & (KEY_EVENT_SIZE - 1)) {
+    uint8_t key = key_events[i].key;
+    if (key == tap_hold_key) { // let go first, a tap
+      unsigned long usec = key_events[i].usec;
+      for (uint8_t j = i; j != tail; j = (j - 1) & (KEY_EVENT_SIZE - 1)) {
+        uint8_t k = (j - 1) & (KEY_EVENT_SIZE - 1);
+        key_events[j].key = key_events[k].key;
+        key_events[j].usec = key_events[k].usec;
+      }
+      key_events[tail].key = key;
+      key_events[tail].usec = usec;
+      return HIGH;
+    }
+    if (!(key & KEY_EVENT_PRESS)) { // a key let go, a hold if it was pressed after the tap/hold key
+      for (uint8_t j = tail; j != i; j = (j + 1) & (KEY_EVENT_SIZE - 1)) {
+        if (key_events[j].key == (key | KEY_EVENT_PRESS)) {
+          tap_hold_to_hold();
+          return HIGH;
+        }
+      }
+    }
+  }
+  return LOW;
+}
+// Function to do the action of a key when it is pressed. A tap/hold key that was waiting has been decided by
+// tap_hold_decide, so its layer or modifier is in effect for this key if it is a hold.
+void key_press(uint8_t key)
+{
+  uint16_t action = layer_action(key);
+  key_action[key] = action;
+  switch (action & ACT_KIND) {
+    case ACT_KEY:
+      report_key(key, HIGH);
+      break;
+    case ACT_MOD:
+    case ACT_MO:
+      special_key(key, HIGH);
+      break;
+    case ACT_TG:
+      layer_lock = layer_lock ^ (1 << (action & 0x0f));
+      update_special();
+      break;
+    case ACT_CTL:
+      control_press(action & 0xff, key / NUM_COLS, key % NUM_COLS);
+      break;
+    case ACT_MACRO:
+      if ((key_macro == NULL) && ((action & 0xff) < NUM_KEY_MACROS)) { // a macro doesn't start while one is typed
+        key_macro = key_macros[action & 0xff];
+        key_macro_down = LOW;
+      }
+      break;
+    case ACT_LT:
+    case ACT_MT:
+      tap_hold_key = key; // wait to see if it is a tap or a hold
+      tap_hold_ms = millis();
+      break;
+  }
+}
+// Function to finish the action of a key when it is released. Returns HIGH if it was a tap, which goes in a
+// report of its own.
+boolean key_release(uint8_t key)
+{
+  uint16_t action = key_action[key];
+  key_action[key] = 0;
+  if (key == tap_hold_key) { // let go before it became a hold, so send the key for a tap
+    tap_hold_key = NO_KEY;
+    key_action[key] = ACT_KEY | (action & 0xff);
+    report_key(key, HIGH);
+    tap_release_key = key; // the release goes in the next report
+    return HIGH;
+  }
+  switch (action & ACT_KIND) {
+    case ACT_KEY:
+      report_key(key, LOW);
+      break;
+    case ACT_MOD:
+    case ACT_MO:
+      special_key(key, LOW);
+      break;
+    case ACT_CTL:
+      control_release(action & 0xff);
+      break;
+  }
+  return LOW;
+}
+// Function to type the next half of a macro step: the key with the step's modifiers, then the key let go.
+// The keys held on the keyboard are sent again when the macro is done.
+void macro_flush()
+{
+  uint8_t keys[REPORT_KEYS] = {0, 0, 0, 0, 0, 0};
+  uint16_t step = pgm_read_word(key_macro);
+  if (millis() == kbd_report_ms) { // a keyboard report already went in this usb frame
+    return;
+  }
+  kbd_report_ms = millis();
+  if (!key_macro_down) {
+    keys[0] = step & 0xff;
+    send_keys(modifiers | ((step >> 8) & 0x0f), keys);
+    key_macro_down = HIGH;
+    return;
+  }
+  send_keys(modifiers, keys);
+  key_macro_down = LOW;
+  key_macro++;
+  if (pgm_read_word(key_macro) == 0) { // last step
+    key_macro = NULL;
+    kbd_report_pending = HIGH;
+  }
+}
+// Function to send the pending keyboard report over usb, at most one keyboard report per usb frame
+void keyboard_flush()
+{
+  if (millis() == kbd_report_ms) { // the report waits for the next frame
+    return;
+  }
+  if (kbd_report_pending && (key_macro == NULL)) { // a macro being typed sends its own reports
+    if (send_report(modifiers)) {
+      if (kbd_event_usec) {
+        phase_record(PHASE_KEY_LATENCY, micros() - kbd_event_usec); // from the oldest change in the report
+      }
+      kbd_report_ms = millis();
+      kbd_reports_sent++;
+      kbd_reports_saved = kbd_reports_saved + kbd_edges - 1;
+    }
+    else { // same as the last report so nothing was sent
+      kbd_reports_saved = kbd_reports_saved + kbd_edges;
+    }
+    kbd_report_pending = LOW;
+    kbd_edges = 0;
+    kbd_event_usec = 0;
+    if (tap_release_key != NO_KEY) { // a tapped key is let go in the next report
+      report_key(tap_release_key, LOW);
+      key_action[tap_release_key] = 0;
+      tap_release_key = NO_KEY;
+      kbd_report_pending = HIGH;
+    }
+  }
+}
+// Function to take the key events of the finished scan passes into key_down and do their actions, oldest first.
+// Events of a pass still being scanned wait for its end, so the report never has half of the matrix. A key that changes a
+// second time stops the batch, so its second change goes in the next report and a quick tap is never folded
+// away, and so does a tap/hold tap. A key pressed while a tap/hold key waits stays in the queue until
+// tap_hold_decide knows which it is. Returns the micros() time of the first event taken, or 0 with none taken.
+unsigned long take_key_events()
+{
+  uint8_t taken[NUM_ROWS]; // keys changed in this batch
+  unsigned long first = 0;
+  memset(taken, 0, sizeof(taken));
+  uint8_t tail = key_event_tail;
+  uint8_t pass = key_event_pass;
+  while (tail != pass) {
+    if ((tap_hold_key != NO_KEY) && (key_events[tail].key & KEY_EVENT_PRESS) && !tap_hold_decide(tail, pass)) {
+      break;
+    }
+    uint8_t key = key_events[tail].key;
+    uint8_t row = (key & ~KEY_EVENT_PRESS) / NUM_COLS;
+    uint8_t mask = 1 << (key % NUM_COLS);
+    if (taken[row] & mask) {
+      break;
+    }
+    taken[row] = taken[row] | mask;
+    if (!first) {
+      first = key_events[tail].usec | 1; // never 0
+    }
+    tail = (tail + 1) & (KEY_EVENT_SIZE - 1);
+    if (key & KEY_EVENT_PRESS) {
+      key_down[row] = key_down[row] | mask;
+      key_press(key & ~KEY_EVENT_PRESS);
+    }
+    else {
+      key_down[row] = key_down[row] & ~mask;
+      if (key_release(key)) {
+        break;
+      }
+    }
+  }
+  key_event_tail = tail; // free the locations for the scan
+  return first;
+}
+// Function to gather the key events since the last time into the pending keyboard report.
+// All of the changes taken go in a single report. Nothing is sent if no key changed.
+void process_matrix()
+{
+  keyboard_flush(); // a report still waiting from the last scan goes first so a quick tap isn't lost
+  if (kbd_report_pending || key_macro) { // it couldn't go in this usb frame, so the new events wait in the queue
+    return;
+  }
+  if ((tap_hold_key != NO_KEY) && ((millis() - tap_hold_ms) >= TAP_HOLD_MS)) { // held long enough
+    tap_hold_to_hold(); // before the keys held back for it are taken
+  }
+  unsigned long first = take_key_events();
+  if (kbd_edges) { // the usb task sends the report
+    kbd_report_pending = HIGH;
+    if (!kbd_event_usec) {
+      kbd_event_usec = first;
+    }
+  }
+}
+// Function to send the pending touchpad buttons or movement as one mouse report. A button change goes first
+// and the movement waits for the next usb frame (the usb mouse code sends a report for every button change).
+void mouse_flush()
+{
+  if (mouse_buttons_pending) {
+    Mouse.set_buttons(mouse_left, 0, mouse_right);
+    mouse_buttons_pending = LOW;
+  }
+  else if (mouse_dx || mouse_dy) {
+    int8_t x = constrain(mouse_dx, -127, 127); // a report holds at most 127 counts, the rest waits
+    int8_t y = constrain(mouse_dy, -127, 127);
+    Mouse.move(x, y);
+    mouse_dx = mouse_dx - x;
+    mouse_dy = mouse_dy - y;
+  }
+  else {
+    return; // nothing to send
+  }
+  mouse_reports_sent++;
+  if (mouse_events > 1) {
+    mouse_reports_saved = mouse_reports_saved + mouse_events - 1;
   }
-  mstat = tp_read(); // read and save into status variable
-  mx = tp_read(); // read and save into x variable
-  my = tp_read(); // read and save into y variable
+  mouse_events = 0;
+}
+// Function to add one touchpad packet to the pending x, y movement and left, right button status
+void touchpad_packet()
+{
+  over_flow = 0; // assume no overflow until status is received 
+  mstat = tp_packet[0]; // save into status variable
+  mx = tp_packet[1]; // save into x variable
+  my = tp_packet[2]; // save into y variable
   if (((0x80 & mstat) == 0x80) || ((0x40 & mstat) == 0x40))  {   // x or y overflow bits set?
     over_flow = 1; // set the overflow flag
   }   
@@ -2014,9 +1631,11 @@ if (touchpad_fail == LOW) {  //skip touchpad section if it failed to initialize
     mx = 0x00;       // data is garbage so zero it out
     my = 0x00;
   } 
-// send the x and y data back via usb if either one is non-zero and the touchpad is enabled
+// add the x and y data to the movement waiting to go over usb if either one is non-zero and the touchpad is enabled
   if (((mx != 0x00) || (my != 0x00)) && touchpad_enabled){
-    Mouse.move(mx,my);
+    mouse_dx = mouse_dx + (int8_t)mx;
+    mouse_dy = mouse_dy + (int8_t)my;
+    mouse_events++;
   }
 //
 // send the touchpad left and right button status over usb if no error
@@ -2037,40 +1656,147 @@ if (touchpad_fail == LOW) {  //skip touchpad section if it failed to initialize
     button_change = (left_button ^ old_left_button) | (right_button ^ old_right_button);
 // Don't send button status if there's no change since last time. 
     if (button_change){
-      Mouse.set_buttons(left_button, 0, right_button); // send button status
+      if (mouse_buttons_pending) { // send the change before this one first so a quick click isn't lost
+        mouse_flush();
+      }
+      mouse_left = left_button; // the usb task sends the button status
+      mouse_right = right_button;
+      mouse_buttons_pending = HIGH;
+      mouse_events++;
     }
     old_left_button = left_button; // remember new button status for next polling cycle
     old_right_button = right_button;
   }
 }
+// Function to put the touchpad bytes from the ring buffer together into packets and send each one over usb.
+// The first byte of a packet always has bit 3 set. Bytes are skipped until one is found so a lost byte
+// doesn't throw off the packets that follow.
+void touchpad_service()
+{
+  while (tp_available()) {
+    if (tp_rx_error) { // the interrupt threw a byte away so the packet being put together is bad
+      tp_rx_error = LOW;
+      tp_packet_count = 0;
+    }
+    char data = tp_read();
+    if ((tp_packet_count == 0) && ((data & 0x08) == 0)) { // not a status byte so keep looking for the start
+      continue;
+    }
+    tp_packet[tp_packet_count] = data;
+    tp_packet_count++;
+    if (tp_packet_count == 3) { // whole packet received
+      tp_packet_count = 0;
+      touchpad_packet();
+    }
+  }
+}
+// Keyboard task: scan the matrix and send the keys that changed over usb
+void keyboard_task()
+{
+  process_matrix(); // build the usb report from the key events (the scan interrupt fills the queue)
+  if (scan_passes != scan_passes_timed) { // time the scan once a pass, the interrupt only keeps the longest tick
+    noInterrupts();
+    uint16_t ticks = scan_pass_ticks;
+    scan_passes_timed = scan_passes;
+    interrupts();
+    phase_record(PHASE_SCAN, ticks / (F_CPU / 8 / 1000000));
+  }
+// Turn on the Caps Lock LED (by sending a low) if bit D1 in the keyboard_leds variable is set, else turn off the LED.
 //
-// ---------------------------------------------Touchpad complete-------------------------------------------
+  if ((keyboard_leds & 0x02) == 0x02) {
+    go_0(CAPS_LED); // turn on the CAPS LOCK LED
+  }
+  else {
+    go_1(CAPS_LED); // turn off the CAPS LOCK LED
+  }
+}
+// Touchpad task: send the packets that arrived since the last time
+void touchpad_task()
+{
+  if (touchpad_fail == LOW) {  //skip touchpad if it failed to initialize (allows keyboard to keep working)
+    touchpad_service();
+  }
+}
+// Command task: look at variables controlled by I2C commands & keyboard
+boolean shutdown_pending = LOW; // HIGH once the power off is queued
+unsigned int task_misses = 0; // task runs that were a whole period late (the scheduler counts them)
 //
+// Function to fill in the timing window of the i2c register block. The values are worked out first and then
+// copied one register at a time so the i2c request interrupt is only held off for a moment.
+void update_perf_registers()
+{
+  uint16_t perf[NUM_PERF_REGS];
+  noInterrupts(); // counts from the scan and touchpad interrupts
+  perf[PERF_TP_TIMEOUT] = tp_timeouts;
+  perf[PERF_KEY_QUEUE_FULL] = key_queue_full;
+  interrupts();
+  perf[PERF_ROLLOVER] = rollover_reports;
+  perf[PERF_TASK_MISSES] = task_misses;
+  for (uint8_t i = 0; i < NUM_PHASES; i++) {
+    phase_stats *p = &phases[i];
+    uint16_t *r = &perf[PERF_PHASE + i * PHASE_REGS];
+    r[0] = p->min;
+    r[1] = p->count ? p->sum / p->count : 0;
+    r[2] = p->max;
+    memcpy(&r[3], p->hist, sizeof(p->hist));
+  }
+  for (uint8_t i = 0; i < NUM_PERF_REGS; i++) {
+    noInterrupts(); // the i2c request interrupt must not see half of a register
+    i2c_regs[NUM_REGS + i] = perf[i];
+    interrupts();
+  }
+}
+// Function to fill in the i2c register block (except the battery voltage, which the adc task does)
+void update_registers()
+{
+  uint16_t status = 0;
+  if (touchpad_fail) {
+    status = status | STATUS_TP_FAIL;
+  }
+  if (touchpad_enabled) {
+    status = status | STATUS_TP_ENABLED;
+  }
+  if (debug) {
+    status = status | STATUS_DEBUG_LED;
+  }
+  if (shutdown_pending) {
+    status = status | STATUS_SHUTDOWN;
+  }
+  if (keyboard_leds & 0x02) {
+    status = status | STATUS_CAPS_LOCK;
+  }
+  if (binary_mode) {
+    status = status | STATUS_BINARY;
+  }
+  noInterrupts(); // the i2c request interrupt must not see half of the update
+  i2c_regs[REG_VERSION] = FW_VERSION;
+  i2c_regs[REG_STATUS] = status;
+  i2c_regs[REG_TP_PARITY] = tp_parity_errors;
+  i2c_regs[REG_TP_FRAME] = tp_frame_errors;
+  i2c_regs[REG_TP_OVERRUN] = tp_overruns;
+  i2c_regs[REG_KBD_SENT] = kbd_reports_sent;
+  i2c_regs[REG_KBD_SAVED] = kbd_reports_saved;
+  i2c_regs[REG_MOUSE_SENT] = mouse_reports_sent;
+  i2c_regs[REG_MOUSE_SAVED] = mouse_reports_saved;
+  interrupts();
+}
+void command_task()
+{
 // ************Pi and Teensy Reset via keyboard***********************************************
   // send pi a reset pulse if control-alt-r keys are pressed
-  if (!old_key_R && !old_key_ALT && !old_key_CTRL) {  
+  if (key_reported(KEY_R) && (modifiers & MODIFIERKEY_ALT & 0xff) && (modifiers & MODIFIERKEY_CTRL & 0xff)) {  
     reset_all = HIGH;
   }
 //
 // ************Laptop Shutdown via keyboard***********************************************
   // Turn voltage regulators off if control-alt-s keys are pressed
-  if (!old_key_S && !old_key_ALT && !old_key_CTRL) {  
+  if (key_reported(KEY_S) && (modifiers & MODIFIERKEY_ALT & 0xff) && (modifiers & MODIFIERKEY_CTRL & 0xff)) {  
     kill_power = HIGH;
   }
 //
-
-// Turn on the Caps Lock LED (by sending a low) if bit D1 in the keyboard_leds variable is set, else turn off the LED.
-//
-  if ((keyboard_leds & 0x02) == 0x02) {
-    go_0(CAPS_LED); // turn on the CAPS LOCK LED
-  }
-  else {
-    go_1(CAPS_LED); // turn off the CAPS LOCK LED
-  }
-// Look at variables controlled by I2C commands & keyboard
-  if (kill_power) {  
-    delay(6000); // give Pi time to finish shutdown before removing power
-    go_1(SHUTDOWN); // send a logic 1 to turn off all power  
+  if (kill_power && !shutdown_pending) {  
+    schedule_pin(SHUTDOWN, GO_1, millis() + SHUTDOWN_WAIT); // give Pi time to finish shutdown, then send a logic 1 to turn off all power
+    shutdown_pending = HIGH;
   }
   if (reset_all) {
     go_0(RESET_PI); // send Pi reset active low
@@ -2085,34 +1811,163 @@ if (touchpad_fail == LOW) {  //skip touchpad section if it failed to initialize
     go_1(DISK_LED); // turn off the led with the disk icon 
   }  
   if (blink_display) { 
-    go_0(On_Off); // pulse the display power button low  
-    delay(100); // for 100ms
-    go_z(On_Off); // and then high to turn off the display 
-    delay(300); // wait 300ms before proceeding
-    go_0(On_Off); // pulse the display power button low  
-    delay(100); // for 100ms
-    go_z(On_Off); // and then high to turn on the display 
-    blink_display = LOW; // turn off variable to avoid blinking on next polling cycle
-  }
-// Blink LED on Teensy to show it's alive
-//
-  if (blink_count == 0x0a) {  
-    pinMode(BLINK_LED, OUTPUT);
-    digitalWrite(BLINK_LED, blinky);
-    blinky = !blinky;
-    blink_count = 0;
+    lcd_start(blink_macro); // turn the display off and back on
+    blink_display = LOW; // turn off variable to avoid blinking again
+  }
+  if (clear_stats) { // start the timing and error counts again
+    memset(phases, 0, sizeof(phases));
+    noInterrupts(); // counts from the scan and touchpad interrupts
+    tp_timeouts = 0;
+    key_queue_full = 0;
+    interrupts();
+    rollover_reports = 0;
+    task_misses = 0;
+    clear_stats = LOW;
+  }
+  update_registers();
+  update_perf_registers();
+}
+// ADC task: read the battery voltage 8 times and take the average to filter out noise
+void adc_task()
+{
+  int adc_sum = 0;
+  for (int i=0; i<8; i++) {
+    adc_sum = analogRead(0) + adc_sum; // sum 8 adc reads together
+  }
+  adc_ave = adc_sum >> 3; // divide sum by 8 to get average
+  uint16_t mv = ((uint32_t)(adc_ave + ADC_OFFSET) * 20000 + 511) / 1023; // battery mV, rounded
+  uint16_t tenths = (mv + BATTERY_TEXT_MV) / 100; // battery voltage in 0.1 volts for the text
+  if (tenths > BATTERY_HIGH_TENTHS) {
+    tenths = BATTERY_HIGH_TENTHS;
+  }
+  char text[16];
+  memcpy(text, "Battery = 00.0v", 16);
+  if (mv < BATTERY_LOW_MV) {
+    memcpy(text, "Battery < 14.0v", 16);
   }
   else {
-    blink_count = blink_count + 1;
+    text[10] = '0' + (tenths / 100) % 10;
+    text[11] = '0' + (tenths / 10) % 10;
+    text[13] = '0' + tenths % 10;
+  }
+  noInterrupts(); // the i2c request interrupt must not see half of the update
+  i2c_regs[REG_BATTERY_MV] = mv;
+  memcpy(battery_text, text, 15);
+  interrupts();
+}
+// Usb task: send the keyboard and mouse changes gathered since the last usb frame
+void usb_task()
+{
+  if (key_macro) {
+    macro_flush(); // one step of the macro per usb frame
   }
-// Read the battery voltage 8 times and take the average to filter out noise
-  adc_ave = 0;
-  for (int i=0; i<8; i++) {
-    adc_ave = analogRead(0) + adc_ave; // sum 8 adc reads together
+  else {
+    keyboard_flush();
   }
-    adc_ave = adc_ave >> 3; // divide sum by 8 to get average
+  mouse_flush();
+}
+// Blink task: blink LED on Teensy to show it's alive
+void blink_task()
+{
+  pinMode(BLINK_LED, OUTPUT);
+  digitalWrite(BLINK_LED, blinky);
+  blinky = !blinky;
+}
 //
+// The scheduler runs each task every period msec. A task that starts a whole period late counts a miss
+// and is put back on its normal beat instead of running again to catch up. A task with a phase is timed.
+struct task {
+  void (*run)(); // task function
+  unsigned int period; // msec between runs
+  uint8_t phase; // PHASE_ number for the timing registers, or PHASE_NONE
+  unsigned long next; // millis when the task is due
+  unsigned int misses; // number of times the task was a period or more late
+};
+task tasks[] = {
+  { keyboard_task, KEYBOARD_PERIOD, PHASE_NONE, 0, 0 },
+  { touchpad_task, TOUCHPAD_PERIOD, PHASE_TOUCHPAD, 0, 0 },
+  { lcd_task, LCD_PERIOD, PHASE_NONE, 0, 0 },
+  { usb_task, USB_PERIOD, PHASE_USB, 0, 0 },
+  { command_task, COMMAND_PERIOD, PHASE_NONE, 0, 0 },
+  { adc_task, ADC_PERIOD, PHASE_ADC, 0, 0 },
+  { blink_task, BLINK_PERIOD, PHASE_NONE, 0, 0 }
+};
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
 //
-//The keyboard & touchpad scan & ADC takes about 8 msec so wait 22 msec before proceeding with next polling cycle    
-  delay(22);           
+// Function to set every task to be due now
+void tasks_init()
+{
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < NUM_TASKS; i++) {
+    tasks[i].next = now;
+  }
+}
+// Function to run the tasks that are due. Returns HIGH if any task ran. The time is read once, so the tasks due in
+// the same msec run in table order and the keyboard report is built before the usb task sends it.
+boolean run_tasks()
+{
+  boolean ran = LOW;
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < NUM_TASKS; i++) {
+    long late = (long)(now - tasks[i].next);
+    if (late >= 0) { // due
+      if (late >= (long)tasks[i].period) { // missed its time
+        tasks[i].misses++;
+        task_misses++;
+        tasks[i].next = now + tasks[i].period;
+      }
+      else {
+        tasks[i].next = tasks[i].next + tasks[i].period; // stay on the beat
+      }
+      if (tasks[i].phase == PHASE_NONE) {
+        tasks[i].run();
+      }
+      else {
+        unsigned long start = micros();
+        tasks[i].run();
+        phase_record(tasks[i].phase, micros() - start);
+      }
+      ran = HIGH;
+    }
+  }
+  return ran;
+}
+//
+// Setup the keyboard and touchpad. Float the lcd controls & pi reset. Drive the shutdown inactive.
+void setup() {
+  analogReference(EXTERNAL); // Configure ADC to use external 5 volt reference
+  reset_shutdown_init(); // initialize reset and shutdown signals
+  lcd_control_init(); // initialize lcd control signals
+  keyboard_init(); // initialize keyboard 
+  touchpad_init(); // initialize touchpad
+  if (touchpad_error) { // check for error
+    touchpad_init(); // try one more time to initialize the touchpad
+    if (touchpad_error) { 
+      touchpad_fail = HIGH; // touchpad failed to initialize
+    }
+  }
+  Wire.begin(8);                // join i2c bus with address #8
+  Wire.onReceive(receiveEvent); // register event to receive command from Pi
+  Wire.onRequest(requestEvent); // register event to send info back to Pi
+  tasks_init(); // start the scheduler
+}
+//
+// Main Loop runs the tasks that are due and the timed pin actions. A pass that ran a task is timed
+// (the idle passes in between would only fill the histogram with the time of a millis() check).
+// Key events from a finished scan pass are sent right away when no keyboard report has gone in this usb frame,
+// otherwise the keyboard task picks them up on its next beat.
+//
+void loop() {  
+  unsigned long start = micros();
+  boolean ran = run_tasks();
+  if ((key_event_pass != key_event_tail) && (millis() != kbd_report_ms) && (key_macro == NULL) &&
+      (tap_hold_key == NO_KEY)) { // keys held back for a tap/hold key wait for the keyboard task
+    keyboard_task(); // sends the waiting report, or the new one when nothing was waiting
+    keyboard_flush();
+    ran = HIGH;
+  }
+  run_pin_actions();
+  if (ran) {
+    phase_record(PHASE_LOOP, micros() - start);
+  }
 }
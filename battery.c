@@ -0,0 +1,254 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Smart battery register reads with PEC and a retry policy per register.
+// The programs used to read every register twice and check the value
+// against a range to guess if the bit-bang bus was upset. With PEC a bad
+// transfer is found for certain, and only that read is done again.
+//
+// A PEC error is line noise so the read is done again right away.
+// A NACK or clock timeout means the battery is busy, so the next try
+// waits backoff_ms (doubled each time) first.
+// An out of range value that passed PEC really came from the battery,
+// so it is only read again range_retries times.
+//
+// A snapshot reads its whole register list in one bus session with
+// smbus_read_words, then uses battery_read only for the registers that
+// came back bad, so a full dump costs about one bus session.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Add battery_snapshot
+// Rev 1.2 - Oct 17, 2026 - Add the BatteryStatus bit names
+// Rev 1.3 - Oct 17, 2026 - Make battery_field public for battery_log.c
+// Rev 1.4 - Oct 17, 2026 - Accept the whole signed range for Current
+// Rev 1.5 - Oct 17, 2026 - Reject a Current of FFFF (floating bus) when PEC is off
+// Rev 1.6 - Oct 17, 2026 - Move battery_field to battery.h
+//
+#include <unistd.h>
+#include "battery.h"
+
+// Read policy for each register, in enum battery_reg order.
+// Current is left at the full -32768 to 32767 mA of the Smart Battery Data
+// Specification's Current() word. The pack has no documented peak, and the
+// charge and discharge currents can be above 3 A, so any tighter range
+// would throw away real readings under load. A floating bus reads FFFF, a
+// Current of -1 mA, so without PEC to catch it that word is rejected as
+// the old programs did.
+const struct battery_policy battery_regs[BAT_NUM_REGS] = {
+	//cmd   name            signed min    max     tries backoff range floating
+	{0x16, "Battery Status", 0, 0x0000, 0xfffe, 3, 10, 1, 0}, // FFFF is a floating bus
+	{0x09, "Voltage", 0, 6001, 21999, 3, 10, 1, 0}, // mV
+	{0x0a, "Current", 1, -32768, 32767, 3, 10, 1, 1}, // mA, the whole signed range (see above)
+	{0x08, "Temperature", 0, 2332, 3131, 3, 10, 1, 0}, // -40 to 39.9 degrees C
+	{0x0d, "State of Charge", 0, 0, 100, 3, 10, 1, 0}, // percent
+	{0x12, "Time to empty", 0, 0, 0xffff, 3, 10, 0, 0}, // FFFF when charging
+	{0x13, "Time to full", 0, 0, 0xffff, 3, 10, 0, 0}, // FFFF when discharging
+	{0x1a, "Specification Info", 0, 0x0000, 0xfffe, 3, 10, 1, 0},
+};
+
+// BatteryStatus bit names, ending with a null name
+const struct battery_status_bit battery_status_bits[] = {
+	{0x8000, "OVERCHARGE ALARM"},
+	{0x4000, "TERMINATE CHARGE ALARM"},
+	{0x1000, "OVER TEMP ALARM"},
+	{0x0800, "TERMINATE DISCHARGE ALARM"},
+	{0x0200, "REMAINING CAPACITY ALARM"},
+	{0x0100, "REMAINING TIME ALARM"},
+	{0x0080, "Initialized"},
+	{0x0040, "Discharging"},
+	{0x0020, "Fully Charged"},
+	{0x0010, "Fully Discharged"},
+	{0, 0}
+};
+
+// Error counters for each register
+struct battery_errors battery_errors[BAT_NUM_REGS];
+
+// Function to count a failed transfer in the register error counters
+static void count_error(struct battery_errors *e, int result)
+{
+	if (result == SMBUS_NACK)
+	{
+		e->nack++;
+	}
+	else if (result == SMBUS_TIMEOUT)
+	{
+		e->timeout++;
+	}
+	else if (result == SMBUS_PEC_ERROR)
+	{
+		e->pec++;
+	}
+}
+//
+// Function to check a word read from a register against its policy.
+// Returns 1 if the value is good.
+static int good_value(struct smbus *bus, const struct battery_policy *p, int word, int v)
+{
+	if (p->floating && !bus->pec && (word == 0xffff))
+	{
+		return 0; // floating bus, no PEC to tell it from a real FFFF
+	}
+	return (v >= p->min) && (v <= p->max);
+}
+//
+// Function to read a register using its retry policy.
+// Returns 0 with a good value, BATTERY_RANGE with the out of range value
+// in *value, or the SMBUS_ error of the last try.
+int battery_read(struct smbus *bus, enum battery_reg reg, int *value)
+{
+	const struct battery_policy *p = &battery_regs[reg];
+	struct battery_errors *e = &battery_errors[reg];
+	unsigned int backoff = p->backoff_ms; // wait before the next try
+	int range_tries = 0; // out of range values seen so far
+	int result = SMBUS_NACK;
+	int attempt;
+	for (attempt = 0; attempt < p->attempts; attempt++)
+	{
+		e->reads++;
+		int word = smbus_read_word(bus, BATTERY_ADDR, p->cmd);
+		if (word >= 0) // good transfer, now check the value
+		{
+			int v = p->is_signed ? (short)word : word;
+			*value = v;
+			if (good_value(bus, p, word, v))
+			{
+				return 0;
+			}
+			e->range++;
+			result = BATTERY_RANGE;
+			if (range_tries++ >= p->range_retries)
+			{
+				break; // the battery keeps giving this value
+			}
+		}
+		else if (word == SMBUS_PEC_ERROR)
+		{
+			count_error(e, word); // noise on the bus, try again right away
+			result = word;
+		}
+		else if ((word == SMBUS_NACK) || (word == SMBUS_TIMEOUT))
+		{
+			count_error(e, word);
+			result = word;
+			if (attempt < p->attempts - 1) // battery is busy, give it time
+			{
+				usleep(backoff * 1000);
+				backoff *= 2;
+			}
+		}
+		else
+		{
+			result = word; // the i2c device itself failed, no use trying again
+			break;
+		}
+	}
+	e->failed++;
+	return result;
+}
+//
+// Function to read the registers in the regs mask (BAT_MASK bits) in one
+// bus session. Registers that come back bad are read again with their
+// retry policy. Returns the number of registers with a good value.
+int battery_snapshot(struct smbus *bus, unsigned int regs,
+	struct battery_snapshot *snap)
+{
+	int cmds[BAT_NUM_REGS]; // command codes in the session
+	int words[BAT_NUM_REGS]; // word or SMBUS_ error for each command
+	enum battery_reg list[BAT_NUM_REGS]; // register of each command
+	int count = 0;
+	int good = 0;
+	int i;
+	for (i = 0; i < BAT_NUM_REGS; i++)
+	{
+		snap->result[i] = SMBUS_NACK; // not read
+		if (regs & BAT_MASK(i))
+		{
+			list[count] = (enum battery_reg)i;
+			cmds[count++] = battery_regs[i].cmd;
+		}
+	}
+	snap->valid = 0;
+	clock_gettime(CLOCK_REALTIME, &snap->time);
+	smbus_read_words(bus, BATTERY_ADDR, cmds, count, words);
+	for (i = 0; i < count; i++)
+	{
+		enum battery_reg reg = list[i];
+		const struct battery_policy *p = &battery_regs[reg];
+		struct battery_errors *e = &battery_errors[reg];
+		int *value = battery_field(snap, reg);
+		int result;
+		e->reads++;
+		if (words[i] >= 0)
+		{
+			*value = p->is_signed ? (short)words[i] : words[i];
+			result = good_value(bus, p, words[i], *value) ? 0 : BATTERY_RANGE;
+			if (result)
+			{
+				e->range++;
+			}
+		}
+		else
+		{
+			count_error(e, words[i]);
+			result = words[i];
+		}
+		if (result) // one targeted read of just this register
+		{
+			result = battery_read(bus, reg, value);
+		}
+		snap->result[reg] = result;
+		if (result == 0)
+		{
+			snap->valid |= BAT_MASK(reg);
+			good++;
+		}
+	}
+	return good;
+}
+//
+// Function to turn on PEC if the battery supports it. SpecificationInfo
+// bits 4-7 are 3 for a v1.1 battery with PEC. Returns 1 if PEC was turned
+// on, 0 if not, or a negative error if SpecificationInfo could not be read.
+int battery_init(struct smbus *bus)
+{
+	int spec;
+	bus->pec = 0; // read SpecificationInfo without PEC
+	int result = battery_read(bus, BAT_SPEC_INFO, &spec);
+	if (result)
+	{
+		return result;
+	}
+	if (((spec >> 4) & 0x0f) == 3)
+	{
+		bus->pec = 1;
+	}
+	return bus->pec;
+}
+//
+// Function to give the text for a battery_read or smbus error
+const char *battery_error_text(int result)
+{
+	switch (result)
+	{
+		case 0: return "ok";
+		case SMBUS_NACK: return "no acknowledge";
+		case SMBUS_BAD_LENGTH: return "bad block length";
+		case SMBUS_TIMEOUT: return "clock held low";
+		case SMBUS_IO_ERROR: return "i2c device error";
+		case SMBUS_PEC_ERROR: return "PEC error";
+		case BATTERY_RANGE: return "out of range";
+	}
+	return "unknown error";
+}
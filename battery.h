@@ -0,0 +1,128 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Smart battery register reads for read_battery.c and monitor_battery.c.
+// Each register has a retry policy (attempts, NACK backoff, valid range)
+// and its own error counters. A value is only handed back as good when
+// it passed the PEC check (if the battery supports PEC) and the range check.
+//
+// battery_snapshot reads a list of registers back to back in one bus
+// session and gives them back in a struct with the time they were read.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Add battery_snapshot
+// Rev 1.2 - Oct 17, 2026 - Add the BatteryStatus bit names
+// Rev 1.3 - Oct 17, 2026 - Make battery_field public for battery_log.c
+// Rev 1.4 - Oct 17, 2026 - Add the floating bus column to the read policy
+// Rev 1.5 - Oct 17, 2026 - Move battery_field here so the log programs build without the bus
+//
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <time.h>
+#include "smbus.h"
+
+#define BATTERY_ADDR 0x0b // smart battery address (0x16 w/ write, 0x17 w/ read)
+#define BATTERY_RANGE -10 // read was good on the bus but the value is out of range
+
+// Battery registers, index into battery_regs
+enum battery_reg {
+	BAT_STATUS, // 0x16 BatteryStatus alarm and status bits
+	BAT_VOLTAGE, // 0x09 Voltage in mV
+	BAT_CURRENT, // 0x0a Current in mA, negative when discharging
+	BAT_TEMPERATURE, // 0x08 Temperature in 0.1 K
+	BAT_SOC, // 0x0d RelativeStateOfCharge in percent
+	BAT_TIME_TO_EMPTY, // 0x12 AverageTimeToEmpty in minutes
+	BAT_TIME_TO_FULL, // 0x13 AverageTimeToFull in minutes
+	BAT_SPEC_INFO, // 0x1a SpecificationInfo, tells if the battery does PEC
+	BAT_NUM_REGS
+};
+
+#define BAT_MASK(reg) (1u << (reg)) // register bit for battery_snapshot
+#define BAT_TELEMETRY (BAT_MASK(BAT_STATUS) | BAT_MASK(BAT_VOLTAGE) \
+	| BAT_MASK(BAT_CURRENT) | BAT_MASK(BAT_TEMPERATURE) | BAT_MASK(BAT_SOC) \
+	| BAT_MASK(BAT_TIME_TO_EMPTY) | BAT_MASK(BAT_TIME_TO_FULL))
+
+// Read policy for one register
+struct battery_policy {
+	int cmd; // SMBus command code
+	const char *name; // name for printing
+	int is_signed; // 1 if the word is a signed 16 bit value
+	int min; // smallest good value
+	int max; // largest good value
+	int attempts; // reads before giving up
+	unsigned int backoff_ms; // wait after a NACK or timeout, doubled each time
+	int range_retries; // rereads allowed for an out of range value
+	int floating; // 1 if a word of FFFF is taken as a floating bus when PEC is off
+};
+
+// Error counters for one register
+struct battery_errors {
+	unsigned long reads; // bus transfers
+	unsigned long nack; // battery did not acknowledge
+	unsigned long timeout; // battery held the clock too long
+	unsigned long pec; // packet error code did not match
+	unsigned long range; // good transfer but value out of range
+	unsigned long failed; // battery_read calls that gave no good value
+};
+
+// Name of a BatteryStatus bit
+struct battery_status_bit {
+	int mask; // bit in BatteryStatus
+	const char *name; // name for printing
+};
+
+// Registers read together by battery_snapshot
+struct battery_snapshot {
+	struct timespec time; // CLOCK_REALTIME when the bus session started
+	unsigned int valid; // BAT_MASK bits of the registers with a good value
+	int result[BAT_NUM_REGS]; // 0, BATTERY_RANGE or SMBUS_ error for each register
+	int status; // BatteryStatus alarm and status bits
+	int voltage; // mV
+	int current; // mA, negative when discharging
+	int temperature; // 0.1 K
+	int soc; // percent
+	int time_to_empty; // minutes, FFFF when charging
+	int time_to_full; // minutes, FFFF when discharging
+	int spec_info; // SpecificationInfo
+};
+
+extern const struct battery_policy battery_regs[BAT_NUM_REGS];
+extern struct battery_errors battery_errors[BAT_NUM_REGS];
+extern const struct battery_status_bit battery_status_bits[];
+
+int battery_init(struct smbus *bus);
+int battery_read(struct smbus *bus, enum battery_reg reg, int *value);
+int battery_snapshot(struct smbus *bus, unsigned int regs,
+	struct battery_snapshot *snap);
+const char *battery_error_text(int result);
+
+// Function to give the field of a snapshot that holds a register. It is
+// here instead of battery.c so the log programs don't need the bus code.
+static inline int *battery_field(struct battery_snapshot *snap, enum battery_reg reg)
+{
+	switch (reg)
+	{
+		case BAT_STATUS: return &snap->status;
+		case BAT_VOLTAGE: return &snap->voltage;
+		case BAT_CURRENT: return &snap->current;
+		case BAT_TEMPERATURE: return &snap->temperature;
+		case BAT_SOC: return &snap->soc;
+		case BAT_TIME_TO_EMPTY: return &snap->time_to_empty;
+		case BAT_TIME_TO_FULL: return &snap->time_to_full;
+		default: return &snap->spec_info;
+	}
+}
+
+#endif
@@ -0,0 +1,131 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Time to cutoff estimator, see battery_estimate.h.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Keep the level acted on so each level is passed in order
+//
+#include <stdlib.h>
+#include <string.h>
+#include "battery_estimate.h"
+
+#define STAT_DISCHARGING 0x0040 // battery is discharging (charger unplugged)
+#define TAU_LOAD 120.0 // seconds, smoothing of the load and resting voltage
+#define TAU_SLOPE 600.0 // seconds, smoothing of the voltage slope
+#define STEP_MA 300 // load change that is used to learn the resistance
+#define R_START 150.0 // milliohms before a load step has been seen
+#define R_MIN 20.0 // smallest believable pack resistance
+#define R_MAX 1000.0 // largest believable pack resistance
+#define R_WEIGHT 0.25 // weight of each new resistance measurement
+#define MIN_SLOPE 0.05 // mV per minute, flatter than this gives no estimate
+#define READY 3 // samples before the voltage estimate is used
+#define SOC_EMPTY 2 // SoC that shuts down whatever the estimate says
+
+// Function to clear the estimator when discharging starts
+void battery_estimate_init(struct battery_estimate *est)
+{
+	memset(est, 0, sizeof(*est));
+	est->resistance = R_START;
+	est->minutes = -1;
+}
+//
+// Function to add a voltage and current sample to the averages
+static void add_sample(struct battery_estimate *est, time_t now, int voltage, int load)
+{
+	if (est->samples == 0)
+	{
+		est->rest = est->last_rest = voltage + load * est->resistance / 1000;
+		est->load = load;
+		est->slope = 0;
+	}
+	else
+	{
+		double dt = (double)(now - est->last);
+		if (dt <= 0)
+		{
+			return; // same time as the last sample
+		}
+		if (abs(load - est->last_load) >= STEP_MA) // load step, V = rest - I * R
+		{
+			double r = (est->last_voltage - voltage) * 1000.0 / (load - est->last_load);
+			if ((r >= R_MIN) && (r <= R_MAX))
+			{
+				est->resistance += R_WEIGHT * (r - est->resistance);
+			}
+		}
+		double rest = voltage + load * est->resistance / 1000;
+		double a = dt / (TAU_LOAD + dt); // weight of this sample
+		est->rest += a * (rest - est->rest);
+		est->load += a * (load - est->load);
+		a = dt / (TAU_SLOPE + dt);
+		est->slope += a * ((rest - est->last_rest) * 60 / dt - est->slope);
+		est->last_rest = rest;
+	}
+	est->samples++;
+	est->last = now;
+	est->last_voltage = voltage;
+	est->last_load = load;
+}
+//
+// Function to add a snapshot and return the action level. The level from
+// the predicted minutes (or the SoC until there is a prediction) only goes
+// up one step per check, so one odd sample can't shut the Pi down.
+enum battery_level battery_estimate_update(struct battery_estimate *est,
+	const struct battery_snapshot *snap)
+{
+	int level = BATTERY_OK;
+	if (!(snap->valid & BAT_MASK(BAT_STATUS)))
+	{
+		return est->level; // nothing new, stay where we were
+	}
+	if (!(snap->status & STAT_DISCHARGING))
+	{
+		battery_estimate_init(est); // charging, start again next discharge
+		return BATTERY_OK;
+	}
+	if ((snap->valid & BAT_MASK(BAT_VOLTAGE)) && (snap->valid & BAT_MASK(BAT_CURRENT)))
+	{
+		add_sample(est, snap->time.tv_sec, snap->voltage, (snap->current < 0) ? -snap->current : 0);
+	}
+	est->minutes = -1;
+	if ((est->samples >= READY) && (est->slope < -MIN_SLOPE))
+	{
+		double headroom = est->rest - est->load * est->resistance / 1000 - BATTERY_CUTOFF_MV;
+		est->minutes = (headroom > 0) ? (int)(headroom / -est->slope) : 0;
+	}
+	if ((snap->valid & BAT_MASK(BAT_TIME_TO_EMPTY)) && (snap->time_to_empty != 0xffff)
+		&& ((est->minutes < 0) || (snap->time_to_empty < est->minutes)))
+	{
+		est->minutes = snap->time_to_empty;
+	}
+	if (est->minutes >= 0)
+	{
+		level = (est->minutes <= BATTERY_SHUTDOWN_MIN) ? BATTERY_SHUTDOWN
+			: (est->minutes <= BATTERY_BLINK_MIN) ? BATTERY_BLINK
+			: (est->minutes <= BATTERY_WARN_MIN) ? BATTERY_WARN : BATTERY_OK;
+	}
+	else if (snap->valid & BAT_MASK(BAT_SOC)) // the old monitor's SoC thresholds
+	{
+		level = (snap->soc <= 5) ? BATTERY_SHUTDOWN : (snap->soc <= 7) ? BATTERY_BLINK
+			: (snap->soc <= 10) ? BATTERY_WARN : BATTERY_OK;
+	}
+	if ((snap->valid & BAT_MASK(BAT_SOC)) && (snap->soc <= SOC_EMPTY))
+	{
+		level = BATTERY_SHUTDOWN;
+	}
+	est->wanted = level;
+	est->level = (level > est->level + 1) ? est->level + 1 : level; // one step up a check
+	return est->level;
+}
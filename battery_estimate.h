@@ -0,0 +1,71 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Prediction of the minutes left before the battery reaches the cutoff
+// voltage, used by monitor_battery.c to pick the warning, blink and
+// shutdown times and by replay_battery.c to test it on recorded history.
+//
+// The pack voltage drops by the load current times the pack resistance,
+// so a change in load moves the voltage without changing the charge. The
+// resistance is learned from load steps and the drop is added back to give
+// a resting voltage. The resting voltage, its slope and the load are each
+// smoothed with an exponentially weighted moving average whose weight
+// follows the time between samples, so the varying check interval does
+// not change the smoothing. The minutes to cutoff are then
+//   (resting voltage - load * resistance - cutoff) / slope
+// and the smaller of that and the battery's AverageTimeToEmpty is used.
+// Until there is an estimate the SoC thresholds of the old monitor are used.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - level is the level acted on, wanted the one it steps to
+//
+#ifndef BATTERY_ESTIMATE_H
+#define BATTERY_ESTIMATE_H
+
+#include "battery.h"
+
+#define BATTERY_CUTOFF_MV 12400 // 3.1 volts a cell, above the pack's own 3.0 volt cutoff
+#define BATTERY_WARN_MIN 20 // minutes to cutoff that turn on the warning LED
+#define BATTERY_BLINK_MIN 10 // minutes to cutoff that blink the display
+#define BATTERY_SHUTDOWN_MIN 4 // minutes to cutoff that shut down the Pi
+
+// Action levels, each needs the level below it on the check before
+enum battery_level {
+	BATTERY_OK,
+	BATTERY_WARN, // turn on the disk LED
+	BATTERY_BLINK, // blink the display
+	BATTERY_SHUTDOWN // safe shutdown
+};
+
+// Estimator state, reset whenever the battery is not discharging
+struct battery_estimate {
+	time_t last; // time of the last voltage and current sample
+	int samples; // voltage and current samples since discharging started
+	int last_voltage; // mV of the last sample
+	int last_load; // mA drawn in the last sample
+	double last_rest; // resting voltage of the last sample, mV
+	double resistance; // pack resistance in milliohms
+	double load; // average mA drawn
+	double rest; // average resting voltage, mV
+	double slope; // average change in resting voltage, mV per minute
+	int minutes; // predicted minutes to cutoff, -1 if none
+	int level; // level returned by the last check, it goes up one step a check
+	int wanted; // level from the SoC or minutes on the last check
+};
+
+void battery_estimate_init(struct battery_estimate *est);
+enum battery_level battery_estimate_update(struct battery_estimate *est,
+	const struct battery_snapshot *snap);
+
+#endif
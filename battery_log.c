@@ -0,0 +1,324 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Battery telemetry ring file, see battery_log.h for the format.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Don't read the block the writer clears next
+// Rev 1.2 - Oct 17, 2026 - Key records only hold the registers read so far
+//
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "battery_log.h"
+
+#define RECORD_MAX (1 + 5 + 5 * BATTERY_LOG_FIELDS) // tag, time and 7 values, 5 bytes per varint
+#define TAG_RECORD 0x80 // tag bit 7, set in every record
+
+// Function to add an unsigned varint, 7 bits per byte with bit 7 set
+// when another byte follows. Returns the bytes used.
+static int put_varint(unsigned char *p, uint32_t value)
+{
+	int n = 0;
+	while (value >= 0x80)
+	{
+		p[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	p[n++] = value;
+	return n;
+}
+//
+// Function to take a varint off the block. Returns the bytes used, or 0
+// if it runs past the end.
+static int get_varint(const unsigned char *p, unsigned int left, uint32_t *value)
+{
+	uint32_t v = 0;
+	unsigned int n;
+	for (n = 0; (n < left) && (n < 5); n++)
+	{
+		v |= (uint32_t)(p[n] & 0x7f) << (7 * n);
+		if (!(p[n] & 0x80))
+		{
+			*value = v;
+			return n + 1;
+		}
+	}
+	return 0;
+}
+//
+// Zigzag folds the sign into bit 0 so small changes either way are 1 byte
+static uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+//
+// Function to encode a sample against the one before it. A key record
+// has base set to 0 so the time and every value read so far is written
+// in full, and its tag is the registers that have a value.
+static int encode(unsigned char *rec, struct battery_snapshot *cur,
+	const struct battery_snapshot *base)
+{
+	unsigned char tag = TAG_RECORD;
+	int n = 1;
+	int reg;
+	n += put_varint(rec + n, (uint32_t)(cur->time.tv_sec - (base ? base->time.tv_sec : 0)));
+	for (reg = 0; reg < BATTERY_LOG_FIELDS; reg++)
+	{
+		int value = *battery_field(cur, reg);
+		int old = base ? *battery_field((struct battery_snapshot *)base, reg) : 0;
+		if (base ? (value != old) : (cur->valid & BAT_MASK(reg)) != 0)
+		{
+			tag |= BAT_MASK(reg);
+			n += put_varint(rec + n, zigzag(value - old));
+		}
+	}
+	rec[0] = tag;
+	return n;
+}
+//
+// Function to move the writer to the next block in the ring
+static void next_block(struct battery_log *log)
+{
+	struct battery_log_header *h = log->header;
+	unsigned char *block = log->ring + (h->started % h->blocks) * BATTERY_LOG_BLOCK;
+	memset(block, 0, BATTERY_LOG_BLOCK); // empty before a reader can find it
+	atomic_thread_fence(memory_order_release);
+	h->started++;
+	log->pos = 0;
+	log->need_key = 0;
+}
+//
+// Function to open the ring file for writing, making it if it does not
+// exist or has a different layout. Returns 0, or -1 if it can't be used.
+int battery_log_open(struct battery_log *log, const char *path, unsigned int blocks)
+{
+	size_t size = (size_t)(blocks + 1) * BATTERY_LOG_BLOCK;
+	struct stat st;
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	int fresh = (fstat(fd, &st) < 0) || ((size_t)st.st_size != size);
+	if (fresh)
+	{
+		// allocate every block now so appends never grow the file
+		if ((ftruncate(fd, 0) < 0) || posix_fallocate(fd, 0, size))
+		{
+			close(fd);
+			return -1;
+		}
+	}
+	void *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // the map keeps the file open
+	if (map == MAP_FAILED)
+	{
+		return -1;
+	}
+	log->header = map;
+	log->ring = (unsigned char *)map + BATTERY_LOG_BLOCK;
+	log->size = size;
+	struct battery_log_header *h = log->header;
+	if (fresh || (h->magic != BATTERY_LOG_MAGIC) || (h->version != BATTERY_LOG_VERSION)
+		|| (h->block_size != BATTERY_LOG_BLOCK) || (h->blocks != blocks))
+	{
+		memset(map, 0, size);
+		h->version = BATTERY_LOG_VERSION;
+		h->block_size = BATTERY_LOG_BLOCK;
+		h->blocks = blocks;
+		h->started = 0;
+		h->magic = BATTERY_LOG_MAGIC;
+	}
+	log->need_key = 1; // an old file goes on in a new block
+	memset(&log->last, 0, sizeof(log->last));
+	return 0;
+}
+//
+// Function to add a snapshot to the ring. Registers that were not read
+// keep the value from the last sample. A register read for the first
+// time since the log was opened starts a new block, so the key record
+// says it has a value. Returns 0, or -1 if the snapshot had none of the
+// logged registers.
+int battery_log_append(struct battery_log *log, const struct battery_snapshot *snap)
+{
+	unsigned char rec[RECORD_MAX];
+	struct battery_snapshot cur = log->last;
+	int reg;
+	int n;
+	if (!(snap->valid & BAT_TELEMETRY))
+	{
+		return -1;
+	}
+	cur.time = snap->time;
+	cur.valid = log->last.valid | (snap->valid & BAT_TELEMETRY);
+	if (cur.valid != log->last.valid)
+	{
+		log->need_key = 1;
+	}
+	for (reg = 0; reg < BATTERY_LOG_FIELDS; reg++)
+	{
+		if (snap->valid & BAT_MASK(reg))
+		{
+			*battery_field(&cur, reg) = *battery_field((struct battery_snapshot *)snap, reg);
+		}
+	}
+	if (cur.time.tv_sec < log->last.time.tv_sec) // clock went back, deltas can't be negative
+	{
+		log->need_key = 1;
+	}
+	if (!log->need_key)
+	{
+		n = encode(rec, &cur, &log->last);
+		if (log->pos + n > BATTERY_LOG_BLOCK) // block is full
+		{
+			log->need_key = 1;
+		}
+	}
+	if (log->need_key)
+	{
+		next_block(log);
+		n = encode(rec, &cur, 0);
+	}
+	unsigned char *p = log->ring + ((log->header->started - 1) % log->header->blocks)
+		* BATTERY_LOG_BLOCK + log->pos;
+	memcpy(p + 1, rec + 1, n - 1);
+	atomic_thread_fence(memory_order_release); // a reader sees the tag only after the record
+	p[0] = rec[0];
+	log->pos += n;
+	log->last = cur;
+	return 0;
+}
+//
+// Function to flush and unmap the ring file
+void battery_log_close(struct battery_log *log)
+{
+	if (log->header)
+	{
+		msync(log->header, log->size, MS_SYNC);
+		munmap(log->header, log->size);
+		log->header = 0;
+	}
+}
+//
+// Function to decode one block, calling fn for each sample. The tag of
+// the key record gives the registers with a value for the whole block.
+// Returns the samples decoded, or -1 if fn asked to stop.
+static long read_block(const unsigned char *block, battery_log_fn fn, void *arg)
+{
+	struct battery_snapshot snap;
+	unsigned int pos = 0;
+	long count = 0;
+	int reg;
+	memset(&snap, 0, sizeof(snap));
+	while ((pos < BATTERY_LOG_BLOCK) && (block[pos] & TAG_RECORD))
+	{
+		unsigned char tag = block[pos++];
+		uint32_t value;
+		if (!count)
+		{
+			snap.valid = tag & BAT_TELEMETRY; // key record
+		}
+		int n = get_varint(block + pos, BATTERY_LOG_BLOCK - pos, &value);
+		if (!n)
+		{
+			return count; // cut short, the writer is part way through it
+		}
+		pos += n;
+		snap.time.tv_sec += value;
+		for (reg = 0; reg < BATTERY_LOG_FIELDS; reg++)
+		{
+			if (tag & BAT_MASK(reg))
+			{
+				n = get_varint(block + pos, BATTERY_LOG_BLOCK - pos, &value);
+				if (!n)
+				{
+					return count;
+				}
+				pos += n;
+				*battery_field(&snap, reg) += unzigzag(value);
+			}
+		}
+		count++;
+		if (fn(&snap, arg))
+		{
+			return -1;
+		}
+	}
+	return count;
+}
+//
+// Function to decode the whole ring file, oldest sample first. It can be
+// read while the monitor is writing it. The oldest block of a full ring is
+// the one the writer clears next, so it is left out, and a block the writer
+// has started to reuse since the read began is skipped. Returns the samples
+// decoded, or -1 if the file can't be read.
+long battery_log_read(const char *path, battery_log_fn fn, void *arg)
+{
+	struct stat st;
+	long total = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)BATTERY_LOG_BLOCK))
+	{
+		close(fd);
+		return -1;
+	}
+	const unsigned char *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return -1;
+	}
+	const struct battery_log_header *h = (const struct battery_log_header *)map;
+	if ((h->magic != BATTERY_LOG_MAGIC) || (h->version != BATTERY_LOG_VERSION)
+		|| (h->block_size != BATTERY_LOG_BLOCK)
+		|| ((off_t)(h->blocks + 1) * BATTERY_LOG_BLOCK != st.st_size))
+	{
+		munmap((void *)map, st.st_size);
+		return -1;
+	}
+	uint64_t started = h->started;
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t first = (started >= h->blocks) ? started - h->blocks + 1 : 0; // oldest block not next to be cleared
+	uint64_t b;
+	for (b = first; b < started; b++)
+	{
+		uint64_t now = h->started;
+		atomic_thread_fence(memory_order_acquire);
+		if (now >= b + h->blocks)
+		{
+			continue; // the writer is clearing or has reused this block
+		}
+		long n = read_block(map + BATTERY_LOG_BLOCK * (1 + b % h->blocks), fn, arg);
+		if (n < 0)
+		{
+			break;
+		}
+		total += n;
+	}
+	munmap((void *)map, st.st_size);
+	return total;
+}
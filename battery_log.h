@@ -0,0 +1,79 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Battery telemetry history in a fixed size ring file. monitor_battery.c
+// appends each snapshot and read_battery_log.c decodes it.
+//
+// The file is a header block and then a ring of 512 byte blocks, written
+// through a shared memory map. Each block starts with a key record that
+// has the full value of each register read since the log was opened (a
+// register missing from its tag has no value in the block), and the
+// records after it only have what changed:
+//   tag byte - bit 7 set, bits 0-6 are the registers in the record
+//              (BAT_MASK bits of the first 7 battery registers),
+//              0 marks the end of the block
+//   seconds  - varint, time since the last record (since 1970 for a key)
+//   values   - zigzag varint of the change in each register in the tag
+// A sample where only the time moved is 2 bytes. Once the ring is full
+// the oldest block is written over, and a reader can start at any block
+// because each one starts with a key record.
+//
+// Nothing is synced per sample. The kernel writes the dirty pages back on
+// its own schedule, so the SD card sees about one page write per writeback
+// interval instead of a write and a flush every check.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Registers not read yet are left out of the key record
+//
+#ifndef BATTERY_LOG_H
+#define BATTERY_LOG_H
+
+#include <stdint.h>
+#include "battery.h"
+
+#define BATTERY_LOG_MAGIC 0x474c4142 // "BALG"
+#define BATTERY_LOG_VERSION 1
+#define BATTERY_LOG_BLOCK 512 // bytes in a block
+#define BATTERY_LOG_BLOCKS 2048 // default ring size, 1 MB or about 10 days at 10 seconds
+#define BATTERY_LOG_FIELDS 7 // registers logged, BAT_STATUS to BAT_TIME_TO_FULL
+
+// First block of the file
+struct battery_log_header {
+	uint32_t magic; // BATTERY_LOG_MAGIC
+	uint16_t version; // BATTERY_LOG_VERSION
+	uint16_t block_size; // BATTERY_LOG_BLOCK
+	uint32_t blocks; // blocks in the ring
+	uint32_t reserved;
+	uint64_t started; // blocks started since the file was made
+};
+
+// Writer state
+struct battery_log {
+	struct battery_log_header *header; // start of the file map
+	unsigned char *ring; // first ring block
+	size_t size; // bytes mapped
+	unsigned int pos; // next free byte in the current block
+	int need_key; // 1 when the next record starts a new block
+	struct battery_snapshot last; // values in the last record
+};
+
+// Function called for each sample, oldest first. Return non zero to stop.
+typedef int (*battery_log_fn)(const struct battery_snapshot *snap, void *arg);
+
+int battery_log_open(struct battery_log *log, const char *path, unsigned int blocks);
+int battery_log_append(struct battery_log *log, const struct battery_snapshot *snap);
+void battery_log_close(struct battery_log *log);
+long battery_log_read(const char *path, battery_log_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,125 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Sequence locked battery snapshot in POSIX shared memory.
+// Add -lrt to the build on systems with glibc older than 2.34.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+//
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "battery_shm.h"
+
+#define READ_TRIES 100 // give up if the writer is always in the middle of an update
+
+// Function to make (or reuse) the segment for the writer. Other users can
+// read it but not write it. Returns 0 if it could not be made.
+struct battery_shm *battery_shm_create(void)
+{
+	int fd = shm_open(BATTERY_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	fchmod(fd, 0644); // the umask may have taken away the read bits
+	if (ftruncate(fd, sizeof(struct battery_shm)) < 0)
+	{
+		close(fd);
+		return 0;
+	}
+	struct battery_shm *shm = mmap(0, sizeof(struct battery_shm),
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // the mapping stays after the file is closed
+	if (shm == MAP_FAILED)
+	{
+		return 0;
+	}
+	atomic_store_explicit(&shm->seq, 1, memory_order_relaxed); // odd, nothing to read yet
+	shm->count = 0;
+	memset(&shm->snap, 0, sizeof(shm->snap));
+	shm->magic = BATTERY_SHM_MAGIC;
+	atomic_store_explicit(&shm->seq, 2, memory_order_release);
+	return shm;
+}
+//
+// Function to copy a snapshot into the segment
+void battery_shm_publish(struct battery_shm *shm, const struct battery_snapshot *snap)
+{
+	unsigned int seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+	atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed); // odd, update started
+	atomic_thread_fence(memory_order_release); // seq is odd before any data changes
+	shm->snap = *snap;
+	shm->count++;
+	atomic_store_explicit(&shm->seq, seq + 2, memory_order_release); // even, update done
+}
+//
+// Function to map the segment read only for a reader.
+// Returns 0 if the monitor has not made it.
+const struct battery_shm *battery_shm_open(void)
+{
+	struct stat st;
+	int fd = shm_open(BATTERY_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(struct battery_shm)))
+	{
+		close(fd);
+		return 0;
+	}
+	const struct battery_shm *shm = mmap(0, sizeof(struct battery_shm),
+		PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		return 0;
+	}
+	if (shm->magic != BATTERY_SHM_MAGIC)
+	{
+		munmap((void *)shm, sizeof(struct battery_shm));
+		return 0;
+	}
+	return shm;
+}
+//
+// Function to copy the latest snapshot out of the segment. Returns 0, or
+// -1 if nothing has been published or the writer kept it busy.
+int battery_shm_read(const struct battery_shm *shm, struct battery_snapshot *snap,
+	unsigned long *count)
+{
+	int tries;
+	for (tries = 0; tries < READ_TRIES; tries++)
+	{
+		unsigned int before = atomic_load_explicit(&((struct battery_shm *)shm)->seq,
+			memory_order_acquire);
+		if (before & 1)
+		{
+			continue; // writer is in the middle of an update
+		}
+		*snap = shm->snap;
+		*count = shm->count;
+		atomic_thread_fence(memory_order_acquire); // copy is done before seq is read again
+		unsigned int after = atomic_load_explicit(&((struct battery_shm *)shm)->seq,
+			memory_order_relaxed);
+		if (before == after)
+		{
+			return (*count > 0) ? 0 : -1;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,50 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Shared memory copy of the latest battery snapshot. monitor_battery.c
+// owns the battery bus and publishes each snapshot here, and any other
+// program (read_battery --cached) reads it without touching the bus or
+// needing root. The segment is /dev/shm/battery_telemetry.
+//
+// The copy is guarded by a sequence lock. The writer makes seq odd, copies
+// the snapshot, then makes seq even again. A reader copies the snapshot
+// and keeps it only if seq was even and the same before and after, so
+// readers never block the writer and never see half an update.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+//
+#ifndef BATTERY_SHM_H
+#define BATTERY_SHM_H
+
+#include <stdatomic.h>
+#include "battery.h"
+
+#define BATTERY_SHM_NAME "/battery_telemetry" // shm_open name
+#define BATTERY_SHM_MAGIC 0x42415431 // "BAT1", changes if the layout changes
+
+// Layout of the shared memory segment
+struct battery_shm {
+	unsigned int magic; // BATTERY_SHM_MAGIC once the writer has set it up
+	atomic_uint seq; // sequence lock, odd while the writer is copying
+	unsigned long count; // snapshots published since the writer started
+	struct battery_snapshot snap; // latest snapshot
+};
+
+struct battery_shm *battery_shm_create(void);
+void battery_shm_publish(struct battery_shm *shm, const struct battery_snapshot *snap);
+const struct battery_shm *battery_shm_open(void);
+int battery_shm_read(const struct battery_shm *shm, struct battery_snapshot *snap,
+	unsigned long *count);
+
+#endif
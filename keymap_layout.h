@@ -0,0 +1,110 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Keyboard layout for Keyboard_and_Touchpad.ino. Edit this file to remap the keys, no code changes are needed.
+// The sketch includes it more than once with LAYER and KEY_MACRO defined differently, so the compiler turns it
+// into the layer tables in flash, the layer and macro numbers, and the macro step lists.
+//
+// LAYER(name, ...) gives the action of every key of a layer as 16 rows of 8, in the matrix order of the table at
+// the top of the .ino. The first layer is the base layer and is always on. The layers listed after it are on
+// top of it, a key of an active layer that is TRANS uses the layer below. At most 8 layers (a compile error
+// says so if there are more).
+//
+// Actions:
+//   0                        no key
+//   TRANS                    use the action of the next active layer down
+//   KEY_x, MODIFIERKEY_x     Teensyduino key or modifier, sent over usb. The Teensyduino media and system keys
+//                            (KEY_MEDIA_x, KEY_SYSTEM_x) share the modifier code range but are not sent, they
+//                            act as no key.
+//   MO(layer)                the layer is on while the key is held
+//   TG(layer)                turn the layer on, or back off
+//   LT(layer, KEY_x)         tap for the key, hold for the layer
+//   MT(MODIFIERKEY_x, KEY_x) tap for the key, hold for the modifier (left modifiers only)
+//   CTL(CTL_x)               laptop control: lcd card buttons and macros, touchpad on/off
+//   MACRO(name)              type the keys of a KEY_MACRO
+// A key keeps the action it was pressed with until it is released, even if the layers change in between.
+// A tap is a release within TAP_HOLD_MS. A key pressed while it is held is sent after the tap, unless that key
+// is also let go first, which makes it a hold (so rolling from Space into a letter still types the space).
+//
+// KEY_MACRO(name, ...) lists the keys a macro types, one press and release per usb frame. SHIFT(KEY_x) types
+// the key with shift.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release, base, user and Fn layers
+// Rev 1.1 - Oct 17, 2026 - Note the layer limit and the media and system keys
+//
+LAYER(LAYER_BASE,
+//  Col0           Col1              Col2               Col3              Col4             Col5               Col6             Col7
+    0,             0,                MODIFIERKEY_CTRL,  0,                0,               0,                 MODIFIERKEY_CTRL, 0,            // Row0
+    0,             KEY_LEFT,         KEY_DOWN,          KEY_UP,           KEY_PAGE_DOWN,   KEY_PAGE_UP,       KEY_END,         KEY_RIGHT,     // Row1
+    0,             KEY_ENTER,        0,                 KEY_RIGHT_BRACE,  0,               KEY_EQUAL,         KEY_QUOTE,       0,             // Row2
+    KEY_F12,       KEY_PRINTSCREEN,  KEY_SLASH,         KEY_SEMICOLON,    KEY_LEFT_BRACE,  KEY_P,             KEY_MINUS,       KEY_BACKSPACE, // Row3
+    KEY_INSERT,    0,                0,                 0,                KEY_BACKSLASH,   KEY_HOME,          KEY_L,           KEY_DELETE,    // Row4
+    KEY_F10,       KEY_COMMA,        KEY_PERIOD,        KEY_I,            KEY_0,           KEY_9,             KEY_F,           KEY_F11,       // Row5
+    KEY_F8,        KEY_M,            KEY_B,             KEY_8,            KEY_U,           KEY_O,             KEY_J,           KEY_F9,        // Row6
+    KEY_F7,        KEY_N,            KEY_G,             KEY_Y,            KEY_K,           KEY_7,             KEY_H,           KEY_6,         // Row7
+    KEY_F5,        KEY_V,            KEY_S,             KEY_T,            KEY_R,           KEY_5,             KEY_C,           KEY_F6,        // Row8
+    KEY_F3,        KEY_X,            0,                 KEY_E,            KEY_4,           KEY_3,             KEY_D,           KEY_F4,        // Row9
+    KEY_F1,        KEY_Z,            KEY_SPACE,         KEY_Q,            KEY_2,           KEY_1,             KEY_W,           KEY_F2,        // Row10
+    0,             0,                0,                 0,                0,               MODIFIERKEY_SHIFT, 0,               MODIFIERKEY_SHIFT, // Row11
+    KEY_TILDE,     0,                KEY_A,             0,                KEY_TAB,         KEY_CAPS_LOCK,     0,               KEY_ESC,       // Row12
+    0,             MODIFIERKEY_ALT,  0,                 MODIFIERKEY_ALT,  0,               0,                 0,               0,             // Row13
+    0,             0,                0,                 0,                MODIFIERKEY_GUI, 0,                 0,               0,             // Row14
+    MO(LAYER_FN),  0,                0,                 0,                0,               0,                 0,               0              // Row15
+)
+// User layer, turned on and off with Fn & ESC. The keys under 7 8 9 0, U I O P, J K L ; and M . / are a number
+// pad (the Pi's Num Lock must be on), Caps Lock is Esc when tapped and Ctrl when held, Space is the Fn layer
+// when held, and F1 and F2 type macros.
+LAYER(LAYER_USER,
+//  Col0           Col1              Col2               Col3              Col4             Col5               Col6             Col7
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row0
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row1
+    TRANS,         KEYPAD_ENTER,     TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row2
+    TRANS,         TRANS,            KEYPAD_SLASH,      KEYPAD_PLUS,      TRANS,           KEYPAD_MINUS,      TRANS,           TRANS,         // Row3
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             KEYPAD_3,        TRANS,         // Row4
+    TRANS,         TRANS,            KEYPAD_PERIOD,     KEYPAD_5,         KEYPAD_ASTERIX,  KEYPAD_9,          TRANS,           TRANS,         // Row5
+    TRANS,         KEYPAD_0,         TRANS,             KEYPAD_8,         KEYPAD_4,        KEYPAD_6,          KEYPAD_1,        TRANS,         // Row6
+    TRANS,         TRANS,            TRANS,             TRANS,            KEYPAD_2,        KEYPAD_7,          TRANS,           TRANS,         // Row7
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row8
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row9
+    MACRO(MACRO_SUDO), TRANS,        LT(LAYER_FN, KEY_SPACE), TRANS,      TRANS,           TRANS,             TRANS,           MACRO(MACRO_HOME), // Row10
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row11
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           MT(MODIFIERKEY_CTRL, KEY_ESC), TRANS, TRANS,        // Row12
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row13
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row14
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS          // Row15
+)
+// Fn layer, on while Fn is held. F1 Menu, F2 mute, F3 volume down, F4 volume up, F5 and F6 brightness down and up
+// (held to repeat), F7 On/Off, F12 touchpad on/off, ESC the user layer. The rest are the keys below.
+LAYER(LAYER_FN,
+//  Col0           Col1              Col2               Col3              Col4             Col5               Col6             Col7
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row0
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row1
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row2
+    CTL(CTL_TOUCHPAD), TRANS,        TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row3
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row4
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row5
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row6
+    CTL(CTL_ON_OFF), TRANS,          TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row7
+    CTL(CTL_BRIGHT_DN), TRANS,       TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           CTL(CTL_BRIGHT_UP), // Row8
+    CTL(CTL_VOL_DN), TRANS,          TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           CTL(CTL_VOL_UP), // Row9
+    CTL(CTL_MENU), TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           CTL(CTL_MUTE), // Row10
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row11
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TG(LAYER_USER), // Row12
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row13
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS,         // Row14
+    TRANS,         TRANS,            TRANS,             TRANS,            TRANS,           TRANS,             TRANS,           TRANS          // Row15
+)
+//
+KEY_MACRO(MACRO_SUDO, KEY_S, KEY_U, KEY_D, KEY_O, KEY_SPACE) // "sudo "
+KEY_MACRO(MACRO_HOME, SHIFT(KEY_TILDE), KEY_SLASH) // "~/"
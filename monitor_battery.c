@@ -15,503 +15,387 @@
 // Rev 1.0 - Feb 14, 2018 - Original Release 
 // Rev 1.1 - March 7, 2018 - Added old_soc to keep previous value for testing
 // Rev 1.2 - Nov 30 2018 - Added Apache License header
+// Rev 1.3 - Oct 17 2026 - Moved the bit-bang bus to smbus.c
+// Rev 1.4 - Oct 17 2026 - Run the SMBus at 100 kHz, waiting on clock stretching
+// Rev 1.5 - Oct 17 2026 - Optional i2c device argument, ie monitor_battery /dev/i2c-3
+// Rev 1.6 - Oct 17 2026 - Only act on status and soc reads that pass PEC and range checks
+// Rev 1.7 - Oct 17 2026 - Read status and soc together with battery_snapshot
+// Rev 1.8 - Oct 17 2026 - Adaptive check interval, BatteryStatus events and
+//                         shutdown on TERMINATE DISCHARGE ALARM
+// Rev 1.9 - Oct 17 2026 - Send the Teensy commands with teensy_ctl.c instead of
+//                         system("i2cset ..."), run shutdown without a shell
+// Rev 2.0 - Oct 17 2026 - Read all the telemetry registers on each check and
+//                         publish the snapshot in shared memory, see battery_shm.h
+// Rev 2.1 - Oct 17 2026 - Keep a history of the snapshots in a ring file, -l
+// Rev 2.2 - Oct 17 2026 - Warn, blink and shut down on the predicted minutes to
+//                         the cutoff voltage instead of the SoC
+// Rev 2.3 - Oct 17 2026 - Blink once per entry to the blink level, check every
+//                         2 minutes on the charger once the battery is full
 //
 // Execute this program at startup so that it can monitor
-// the battery state of charge every minute.
-// At 10% SoC, the disk LED turns on to indicate a low battery warning. 
-// At 7% SoC, the LCD blinks off and on to get the users attention. 
-// At 5% SoC, a safe shutdown is executed.
+// the battery state of charge.
+// The minutes left before the battery reaches its cutoff voltage are
+// predicted from the voltage, current and AverageTimeToEmpty, see
+// battery_estimate.h. Until there is a prediction the SoC is used.
+// At 20 minutes (10% SoC), the disk LED turns on to indicate a low battery warning. 
+// At 10 minutes (7% SoC), the LCD blinks off and on once to get the users attention. 
+// At 4 minutes (5% SoC), or 2% SoC, or when the battery sets TERMINATE
+// DISCHARGE ALARM on two checks in a row, a safe shutdown is executed.
+// replay_battery.c runs the history file through the same prediction.
+//
+// The battery is checked more often when it matters. On the charger it
+// is checked every 10 seconds, so unplugging the charger is seen quickly,
+// and every 2 minutes once the battery reports FULLY CHARGED (unplugging
+// a full battery leaves hours before the first action level).
+// While discharging the next check is set to about half the time left before
+// the next action level (5 to 120 seconds). A sharp change in current or
+// any alarm bit brings the next check in to 2 to 5 seconds. Every change
+// of a BatteryStatus bit is printed as an event with the time.
+//
+// Each check reads all the telemetry registers in one bus session and
+// publishes the snapshot in shared memory, so other programs (such as
+// read_battery --cached) can see the battery without using the bus.
+// Each snapshot is also added to the history ring file (default
+// /var/log/battery.ring, set with -l), see battery_log.h and
+// read_battery_log.c.
+//
+// A smart battery can also report alarms by becoming bus master and
+// sending AlarmWarning to the host at address 0x08. The Pi is the only
+// master on this bus (GPIO bit-bang or the i2c-gpio driver, neither can
+// act as a slave), so the same alarm bits are read from BatteryStatus.
 // 
 // This program reads the laptop battery status registers over a bit-
 // bang SMBus created with two of the Pi's GPIO pins and wiringPi. 
 // SMBus Data and clock are pulled to 3.3 volts with 3K resistors.
 // Data is wired from Pi GPIO 19 to battery pin 3.
 // Clock is wired from Pi GPIO 26 to battery pin 4.
+// The SMBus bit timing is in smbus.c, shared with read_battery.c.
+// Give an i2c device on the command line (monitor_battery /dev/i2c-3) to
+// use the kernel i2c-gpio driver instead of the GPIO bit-bang, see smbus.h.
+// The Teensy commands go straight to /dev/i2c-1, or to the device or mock
+// file given with -t, see teensy_ctl.h.
 //
+// Build with: gcc -o monitor_battery monitor_battery.c battery.c battery_estimate.c battery_log.c battery_shm.c smbus.c teensy_ctl.c -lwiringPi
 // Add -l wiringPi to the Compile & Build and sudo to the execute per:
 // https://learn.sparkfun.com/tutorials/raspberry-gpio/using-an-ide
 //
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <wiringPi.h>
+#include "smbus.h"
+#include "battery.h"
+#include "battery_estimate.h"
+#include "battery_log.h"
+#include "battery_shm.h"
+#include "teensy_ctl.h"
 
 // Pin number declarations
-const int clock = 26; // SMBus clock on Pin 37, GPIO26
-const int data = 19; // SMBus data on Pin 35, GPIO19
-const int quarter = 10; // quarter period time in usec
+const int clock_pin = 26; // SMBus clock on Pin 37, GPIO26
+const int data_pin = 19; // SMBus data on Pin 35, GPIO19
+
+// Battery status bits
+#define STAT_DISCHARGING 0x0040 // battery is discharging (charger unplugged)
+#define STAT_FULLY_CHARGED 0x0020 // battery is full
+#define STAT_TERMINATE_DISCHARGE 0x0800 // battery wants discharging stopped
+#define STAT_ALARMS 0xdb00 // all the alarm bits
+
+// Check intervals in milliseconds
+#define POLL_CHARGING 10000 // wait while on the charger
+#define POLL_FULL 120000 // wait on the charger once the battery is full
+#define POLL_MIN 5000 // shortest wait while discharging
+#define POLL_MAX 120000 // longest wait while discharging
+#define POLL_ALARM 2000 // wait while an alarm bit is set
+#define CURRENT_STEP 500 // mA change since the last check that counts as sharp
+
+// Action levels, highest first, in predicted minutes and in SoC until
+// there is a prediction
+const int minute_levels[] = {BATTERY_WARN_MIN, BATTERY_BLINK_MIN, BATTERY_SHUTDOWN_MIN, 0};
+const int soc_levels[] = {10, 7, 5, 0};
 
 // Global variables
-int error = 0; // set to 1 when battery gives a NACK
+struct smbus bus; // bit-bang SMBus to the battery
+struct teensy teensy; // i2c link to the Teensy
+struct battery_shm *shm; // shared memory copy of the last snapshot
+struct battery_log history; // ring file of the snapshots
+struct battery_estimate est; // minutes to cutoff prediction
 
 // Functions
-void go_z(int pin) // float the pin and let pullup or battery set level
-{
-	pinMode(pin, INPUT); // set pin as input to tri-state the driver
-}
-//
-void go_0(int pin) // drive the pin low
-{
-	pinMode(pin, OUTPUT); // set pin as output
-	digitalWrite(pin, LOW); // drive pin low
-}
-//
-int read_pin(int pin) // read the pin and return logic level
-{
-	pinMode(pin, INPUT); // set pin as input
-	return (digitalRead(pin)); // return the logic level
-}
-//
-void setupbus(void)
+void status_events(int old_stat, int new_stat) // print each BatteryStatus bit that changed
 {
-	wiringPiSetupGpio(); //Init wiringPi using the Broadcom GPIO numbers
-	piHiPri(99); //Make program the highest priority (doesn't help)
-	go_z(clock); // set clock and data to inactive state
-	go_z(data);
-	delayMicroseconds(200); // wait before sending data
-}
-//
-void startbus(void)
-{
-	delayMicroseconds(1000); // needed when doing multiple reads
-	go_0(data);	// start condition - data low when clock goes low
-	delayMicroseconds(quarter);
-	go_0(clock);
-	delayMicroseconds(4 * quarter); // wait 1 period before proceeding
+	time_t now = time(NULL);
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+	int i;
+	for (i = 0; battery_status_bits[i].name; i++)
+	{
+		int mask = battery_status_bits[i].mask;
+		if ((old_stat ^ new_stat) & mask)
+		{
+			printf ("%s %s %s\n", stamp, battery_status_bits[i].name,
+				(new_stat & mask) ? "on" : "off");
+		}
+	}
+	fflush(stdout); // show the event now when the output is a log
 }
 //
-void send8(int sendbits)
+int discharge_wait(const struct battery_snapshot *snap) // time to the next check while discharging
 {
-	// send bit 7
-	if ((sendbits & 0x80) == 0x80) // check if bit 7 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	}
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 6
-	if ((sendbits & 0x40) == 0x40) // check if bit 6 set
+	int i = 0;
+	long minutes; // minutes until the next action level, if the drain stays the same
+	if (est.minutes > 0)
 	{
-		go_z(data); // send high
+		while (minute_levels[i] >= est.minutes) // find the next level below the prediction
+		{
+			i++;
+		}
+		minutes = est.minutes - minute_levels[i];
 	}
-		else
+	else if ((snap->valid & BAT_MASK(BAT_SOC)) && (snap->soc > 0)
+		&& (snap->valid & BAT_MASK(BAT_TIME_TO_EMPTY)) && (snap->time_to_empty > 0)
+		&& (snap->time_to_empty != 0xffff))
 	{
-		go_0(data); // send low
+		while (soc_levels[i] >= snap->soc) // find the next level below the soc
+		{
+			i++;
+		}
+		minutes = (long)snap->time_to_empty * (snap->soc - soc_levels[i]) / snap->soc;
 	}
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 5
-		if ((sendbits & 0x20) == 0x20) // check if bit 5 set
+	else
 	{
-		go_z(data); // send high
+		return POLL_MIN; // no estimate, check often
 	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 4
-		if ((sendbits & 0x10) == 0x10) // check if bit 4 set
+	long wait = minutes * 60000 / 2; // check again at half that time
+	if (wait < POLL_MIN)
 	{
-		go_z(data); // send high
+		wait = POLL_MIN;
 	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 3
-		if ((sendbits & 0x08) == 0x08) // check if bit 3 set
+	if (wait > POLL_MAX)
 	{
-		go_z(data); // send high
+		wait = POLL_MAX;
 	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 2
-		if ((sendbits & 0x04) == 0x04) // check if bit 2 set
-	{
-		go_z(data); // send high
+	return (int)wait;
+}
+
+int run_command(const char *path, const char *arg1, const char *arg2) // run a program without a shell, 0 if it exits 0
+{
+	int status;
+	fflush(stdout); // so the child does not get a copy of buffered output
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		printf ("Could not start %s: %s\n", path, strerror(errno));
+		fflush(stdout);
+		return -1;
 	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 1
-		if ((sendbits & 0x02) == 0x02) // check if bit 1 set
+	if (pid == 0)
 	{
-		go_z(data); // send high
+		execl(path, path, arg1, arg2, (char *)NULL); // arg2 or both args may be NULL
+		printf ("Could not run %s: %s\n", path, strerror(errno));
+		fflush(stdout);
+		_exit(127);
 	}
-		else
+	while (waitpid(pid, &status, 0) < 0)
 	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 0
-		if ((sendbits & 0x01) == 0x01) // check if bit 0 set
-	{
-		go_z(data); // send high
+		if (errno != EINTR)
+		{
+			printf ("Lost %s: %s\n", path, strerror(errno));
+			fflush(stdout);
+			return -1;
+		}
 	}
-		else
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
 	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// ack/nack
-	delayMicroseconds(quarter * 4);
-	go_z(data); // float data to see ack
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	// read data to see if battery sends a low (acknowledge transfer)
-	if (read_pin(data))
-	{
-		error = 1; // battery did not acknowledge the transfer
+		printf ("%s failed, %s %d\n", path, WIFEXITED(status) ? "exit status" : "signal",
+			WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status));
+		fflush(stdout);
+		return -1;
 	}
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	go_0(data); // data low
-	delayMicroseconds(quarter * 90);
-}
-//
-void sendrptstart(void) // send repeated start condition
-{				
-	go_z(data); // data high
-	delayMicroseconds(quarter * 8);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(data); // data low
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter * 16);
+	return 0;
 }
 //
-int read16(void) // read low and high bytes
+void shutdown_pi(void) // safe shutdown of the Pi, poweroff if shutdown fails
 {
-	int readval = 0x00; // initialize read word to zero
-	// bit 7 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0080;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 6 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0040;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 5 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0020;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 4 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	if (run_command("/sbin/shutdown", "-h", "now") == 0)
 	{
-		readval = readval | 0x0010;
+		return;
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 3 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	if (run_command("/sbin/poweroff", NULL, NULL) == 0)
 	{
-		readval = readval | 0x0008;
+		return;
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 2 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0004;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 1 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0002;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 0 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0001;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// ack/nack of low byte
-	delayMicroseconds(quarter * 2);
-	go_0(data); // send ack back to battery
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	go_0(data); // data low
-	delayMicroseconds(quarter * 40);		
-	// bit 7 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x8000;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 6 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	printf ("Could not shut down, trying again on the next check\n");
+	fflush(stdout);
+}
+//
+void send_teensy(int cmd) // send a command byte to the Teensy
+{
+	if (teensy_command(&teensy, cmd))
 	{
-		readval = readval | 0x4000;
+		printf ("Teensy command 0x%02x failed\n", cmd);
+		fflush(stdout);
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 5 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+}
+
+// Main program	
+int main(int argc, char *argv[])
+{        
+	const char *teensy_path = "/dev/i2c-1"; // Teensy i2c device, or a mock file
+	const char *log_path = "/var/log/battery.ring"; // history ring file
+	int opt;
+	while ((opt = getopt(argc, argv, "t:l:")) != -1)
 	{
-		readval = readval | 0x2000;
+		if (opt == 't')
+		{
+			teensy_path = optarg;
+		}
+		else if (opt == 'l')
+		{
+			log_path = optarg;
+		}
+		else
+		{
+			printf ("Use: monitor_battery [-t teensy device] [-l history file] [battery i2c device]\n");
+			return 1;
+		}
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 4 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	delay(1000); // wait a second before starting
+	if (teensy_open(&teensy, teensy_path))
 	{
-		readval = readval | 0x1000;
+		printf ("Could not open the Teensy on %s\n", teensy_path);
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 3 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	if (optind < argc) // an i2c device such as /dev/i2c-3, or a fake bus file
 	{
-		readval = readval | 0x0800;
+		if (smbus_open_dev(&bus, argv[optind]))
+		{
+			printf ("Could not open %s\n", argv[optind]);
+			return 1;
+		}
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 2 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0400;
+	else if (smbus_open(&bus, &smbus_wiringpi, SMBUS_100KHZ, clock_pin, data_pin))
+	{ // setup the GPIO SMBus before data transfer
+		printf ("Could not set up the GPIO pins\n");
+		return 1;
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 1 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	shm = battery_shm_create();
+	if (!shm)
 	{
-		readval = readval | 0x0200;
+		printf ("Could not create the shared memory snapshot\n");
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 0 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	int logging = (battery_log_open(&history, log_path, BATTERY_LOG_BLOCKS) == 0);
+	if (!logging)
 	{
-		readval = readval | 0x0100;
+		printf ("Could not open the history file %s\n", log_path);
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// ack/nack of high byte
-	delayMicroseconds(quarter * 2);
-	go_z(data); // send nack back to battery
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	go_0(data); // data low
-	delayMicroseconds(quarter * 8);	
-	return readval;
-}
-//
-void stopbus(void) // stop condition, data low when clock goes high
-{
-	go_z(clock); // clock high
-	delayMicroseconds(quarter);	
-	go_z(data);	// data high
-	delayMicroseconds(quarter * 30);	
-}
-
-// Main program	
-int main(void)
-{        
-	delay(1000); // wait a second before starting
-	setupbus(); // setup the GPIO SMBus
+	battery_estimate_init(&est);
 	int led_on = 0; // variable to keep track of when warning led is on
-	int soc; // variable to store the state of charge
-	int old_soc = 50; // soc from last time battery was checked
-	unsigned short bat_stat; // variable to store the battery status
+	int blinked = 0; // set once the display has blinked for the blink level
+	int bat_stat; // variable to store the battery status
+	int old_stat = -1; // status from the last good read, -1 before the first
+	int old_current = 0; // current from the last check while discharging
+	int terminate_count = 0; // checks in a row with TERMINATE DISCHARGE ALARM
+	int pec_checked = 0; // set once SpecificationInfo has been read
+	int wait; // milliseconds to the next check
 	while(1)  // infinite loop
 	{
-		// Read Battery status to see if charger is plugged in
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x16); // load register pointer 0x16
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		bat_stat = read16();
-		stopbus(); // send stop condition
-		if ((bat_stat == 0xffff) | (error))// read again if all 1's or nack
+		if (!pec_checked) // turn on PEC if the battery supports it
 		{
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x16); // load register pointer 0x16
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			bat_stat = read16();
-			stopbus(); // send stop condition
-		}  
-	// Only proceed with reading the SoC if discharge bit is set
-		if ((bat_stat & 0x0040) == 0x0040)
-		{		
-	// Read Battery Relative State of Charge
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x0d); // load soc register pointer 0x0d
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			soc = read16(); // read soc low & high bytes
-			stopbus(); // send stop condition
-			if ((soc >= 150) | (error))//check if out of range or any nack's
-			{	// try again 
-				startbus(); // send start condition
-				send8(0x16); // send battery address 0x16 (0x0b w/ write)
-				send8(0x0d); // load register pointer 0x0d
-				sendrptstart(); // send repeated start codition				
-				send8(0x17); // send battery address 0x17 (0x0b w/ read)
-				soc = read16(); //read low & high bytes
-				stopbus(); // send stop condition
+			pec_checked = (battery_init(&bus) >= 0);
+		}
+		// Read Battery status to see if charger is plugged in.
+		// A status or soc that failed PEC, the range check or every retry
+		// is never used, so a bad read can't cause a shutdown.
+		struct battery_snapshot snap; // registers read in one bus session
+		battery_snapshot(&bus, BAT_TELEMETRY, &snap);
+		if (shm)
+		{
+			battery_shm_publish(shm, &snap); // for readers that can't use the bus
+		}
+		if (logging)
+		{
+			battery_log_append(&history, &snap);
+		}
+		int stat_ok = (snap.valid & BAT_MASK(BAT_STATUS)) != 0;
+		bat_stat = snap.status;
+		if (stat_ok && (bat_stat != old_stat))
+		{
+			if (old_stat >= 0)
+			{
+				status_events(old_stat, bat_stat);
 			}
-			// Check the battery State of Charge for the following:
-			// <= 5% causes a safe shutdown (must have been <= 8% on last check).
-			// <= 7% causes the display to blink (must have been <= 10% on last check).
-			// <= 10% turns on the disk LED as a warning (must have been <= 13% on last check).
-			// Keeping track of the old soc is done in case there is a bad smbus read
-			if ((soc <= 5) & (old_soc <= 8)) // check for shutdown condition
+			old_stat = bat_stat;
+		}
+		enum battery_level level = battery_estimate_update(&est, &snap);
+		wait = POLL_CHARGING;
+	// Only proceed with checking the charge if discharge bit is set
+		if (stat_ok && ((bat_stat & STAT_DISCHARGING) == STAT_DISCHARGING))
+		{		
+			// Check the predicted minutes to cutoff (or the SoC) for the following:
+			// shutdown level causes a safe shutdown (must have been blink level on last check).
+			// blink level causes the display to blink (must have been warning level on last check).
+			// warning level turns on the disk LED (battery_estimate_update does the last check test).
+			// The battery's own TERMINATE DISCHARGE ALARM also causes a shutdown
+			// if it is set on two checks in a row.
+			terminate_count = (bat_stat & STAT_TERMINATE_DISCHARGE) ? terminate_count + 1 : 0;
+			if ((level == BATTERY_SHUTDOWN) | (terminate_count >= 2)) // check for shutdown condition
 			{   
-				system("sudo shutdown -h now"); // safe shutdown of Pi
+				shutdown_pi(); // safe shutdown of Pi
 				// note that a systemd unit file sends 
 				// i2cset -y 1 0x08 0x00 0x5a
 				// which commands the Teensy to turn off the power 
 			}
-			else if ((soc <= 7) & (old_soc <= 10)) // check for blink display condition
+			else if ((level == BATTERY_BLINK) && !blinked) // blink the display once on entering the level
 			{
-				system("i2cset -y 1 0x08 0x00 0xe2"); // blink the display
+				send_teensy(TEENSY_BLINK); // blink the display
+				blinked = 1;
 			}
-			else if ((soc <= 10) & (old_soc <= 13) & (!led_on)) // soc at 10% and LED is off
+			else if ((level == BATTERY_WARN) & (!led_on)) // warning level and LED is off
 			{
-				system("i2cset -y 1 0x08 0x00 0x10"); // turn on disk LED
+				send_teensy(TEENSY_LED_ON); // turn on disk LED
 				led_on = 0x01; // variable shows led is turned on
 			}
-			old_soc = soc; // save soc for next time
+			if (level != BATTERY_BLINK)
+			{
+				blinked = 0; // blink again if the level is entered again
+			}
+			wait = discharge_wait(&snap);
+			if (est.wanted > est.level) // a higher level is waiting on the next check
+			{
+				wait = POLL_MIN;
+			}
+			if (snap.valid & BAT_MASK(BAT_CURRENT))
+			{
+				if (abs(snap.current - old_current) >= CURRENT_STEP) // load changed, look again soon
+				{
+					wait = POLL_MIN;
+				}
+				old_current = snap.current;
+			}
 		}
-		else if (led_on) // charger plugged in and LED is on
+		else if (stat_ok && ((bat_stat & STAT_DISCHARGING) == 0))
+		{
+			terminate_count = 0;
+			old_current = 0;
+			blinked = 0;
+			if (bat_stat & STAT_FULLY_CHARGED) // nothing changes until the charger is unplugged
+			{
+				wait = POLL_FULL;
+			}
+			if (led_on) // charger plugged in and LED is on
 			{
-				system("i2cset -y 1 0x08 0x00 0x11"); // turn off disk LED
+				send_teensy(TEENSY_LED_OFF); // turn off disk LED
 				led_on = 0x00; // variable shows led is turned off
 			}
-	delay(60000);	// wait 60 seconds before repeating the loop
+		}
+		if (stat_ok && (bat_stat & STAT_ALARMS)) // watch an alarm closely
+		{
+			wait = POLL_ALARM;
+		}
+	delay(wait);	// wait before repeating the loop
 	}
 	return 0;
 }
-
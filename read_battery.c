@@ -17,13 +17,21 @@
 // Data is wired from Pi GPIO 19 to battery pin 3.
 // Clock is wired from Pi GPIO 26 to battery pin 4.
 //
-// This program does not monitor the clock for clock stretching.
-// The bus was monitored with a logic analyzer to see when the battery
-// holds the clock low and large delays were added before the Pi sends 
-// more data. Sometimes the program reads back FFFF because Linux
+// The SMBus bit timing is in smbus.c, which is shared with
+// monitor_battery.c. The register reads, with PEC checking and retries,
+// are in battery.c. The bus runs at 100 kHz and waits while the
+// battery stretches the clock. Give an i2c device on the command line
+// (read_battery /dev/i2c-3) to use the kernel i2c-gpio driver instead,
+// see smbus.h. Sometimes the program reads back FFFF because Linux
 // will switch to some other task and mess up the timing of the bus.
-// The program does a second read if the value is out of range.
+// A read is done again when the PEC is bad, the battery does not answer,
+// or the value is out of range; see the policy table in battery.c.
 //
+// read_battery --cached shows the last snapshot monitor_battery put in
+// shared memory (see battery_shm.h) without touching the bus, so it
+// does not need root or fight the monitor for the GPIO pins.
+//
+// Build with: gcc -o read_battery read_battery.c battery.c battery_shm.c smbus.c -lwiringPi
 // Add -l wiringPi to the Compile & Build and sudo to the execute per:
 // https://learn.sparkfun.com/tutorials/raspberry-gpio/using-an-ide
 //
@@ -32,597 +40,190 @@
 // Rev 1.1 - Jan 1, 2018 - Add rev history and public domain
 // Rev 1.2 - March 7, 2018 - Added test for out of range on bat current
 // Rev 1.3 - Nov 30, 2018 - Added Apache License Header
+// Rev 1.4 - Oct 17, 2026 - Moved the bit-bang bus to smbus.c, print the
+//                          manufacturer name and chemistry block registers
+// Rev 1.5 - Oct 17, 2026 - Run the SMBus at 100 kHz, waiting on clock stretching
+// Rev 1.6 - Oct 17, 2026 - Optional i2c device argument, ie read_battery /dev/i2c-3
+// Rev 1.7 - Oct 17, 2026 - PEC and a retry policy per register from battery.c
+//                          replace the range check and blind second read
+// Rev 1.8 - Oct 17, 2026 - Read all the registers in one battery_snapshot
+// Rev 1.9 - Oct 17, 2026 - Add --cached, read the monitor's shared memory snapshot
 //
 #include <stdio.h>
-#include <wiringPi.h>
+#include <string.h>
+#include <time.h>
+#include "smbus.h"
+#include "battery.h"
+#include "battery_shm.h"
 
 // Pin number declarations
-const int clock = 26; // SMBus clock on Pin 37, GPIO26
-const int data = 19; // SMBus data on Pin 35, GPIO19
-const int quarter = 10; // quarter period time in usec
+const int clock_pin = 26; // SMBus clock on Pin 37, GPIO26
+const int data_pin = 19; // SMBus data on Pin 35, GPIO19
 
 // Global variables
-int error = 0; // set to 1 when battery gives a NACK
+struct smbus bus; // bit-bang SMBus to the battery
 
 // Functions
-void go_z(int pin) // float the pin and let pullup or battery set level
-{
-	pinMode(pin, INPUT); // set pin as input to tri-state the driver
-}
-//
-void go_0(int pin) // drive the pin low
+void read_text(int reg, const char *name) // read and print a block string register
 {
-	pinMode(pin, OUTPUT); // set pin as output
-	digitalWrite(pin, LOW); // drive pin low
-}
-//
-int read_pin(int pin) // read the pin and return logic level
-{
-	pinMode(pin, INPUT); // set pin as input
-	return (digitalRead(pin)); // return the logic level
+	unsigned char text[SMBUS_BLOCK_MAX + 1]; // block bytes plus a terminator
+	int len = smbus_read_block(&bus, BATTERY_ADDR, reg, text, SMBUS_BLOCK_MAX);
+	if (len < 0) // try again if nack, PEC error or bad byte count
+	{
+		len = smbus_read_block(&bus, BATTERY_ADDR, reg, text, SMBUS_BLOCK_MAX);
+	}
+	if (len > 0)
+	{
+		text[len] = 0; // the block has no terminator of its own
+		printf ("%s = %s\n", name, text);
+	}
 }
 //
-void setupbus(void)
+// Function to show why a register could not be read. An out of range
+// value came from the battery with a good PEC so it is shown with a note.
+const char *note(int result)
 {
-	wiringPiSetupGpio(); //Init wiringPi using the Broadcom GPIO numbers
-	piHiPri(99); //Make program the highest priority (doesn't help)
-	go_z(clock); // set clock and data to inactive state
-	go_z(data);
-	delayMicroseconds(200); // wait before sending data
+	return (result == BATTERY_RANGE) ? " (out of range)" : "";
 }
 //
-void startbus(void)
+void not_read(enum battery_reg reg, int result) // print a failed read
 {
-	delayMicroseconds(1000); // needed when doing multiple reads
-	go_0(data);	// start condition - data low when clock goes low
-	delayMicroseconds(quarter);
-	go_0(clock);
-	delayMicroseconds(4 * quarter); // wait 1 period before proceeding
+	printf ("%s = not read, %s\n", battery_regs[reg].name, battery_error_text(result));
 }
 //
-void send8(int sendbits)
+void print_errors(void) // print the error counters of registers that had errors
 {
-	// send bit 7
-	if ((sendbits & 0x80) == 0x80) // check if bit 7 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	}
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 6
-	if ((sendbits & 0x40) == 0x40) // check if bit 6 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	}
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 5
-		if ((sendbits & 0x20) == 0x20) // check if bit 5 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 4
-		if ((sendbits & 0x10) == 0x10) // check if bit 4 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 3
-		if ((sendbits & 0x08) == 0x08) // check if bit 3 set
+	int reg;
+	for (reg = 0; reg < BAT_NUM_REGS; reg++)
 	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 2
-		if ((sendbits & 0x04) == 0x04) // check if bit 2 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 1
-		if ((sendbits & 0x02) == 0x02) // check if bit 1 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// send bit 0
-		if ((sendbits & 0x01) == 0x01) // check if bit 0 set
-	{
-		go_z(data); // send high
-	}
-		else
-	{
-		go_0(data); // send low
-	} 
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// ack/nack
-	delayMicroseconds(quarter * 4);
-	go_z(data); // float data to see ack
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	// read data to see if battery sends a low (acknowledge transfer)
-	if (read_pin(data))
-	{
-		error = 1; // battery did not acknowledge the transfer
+		struct battery_errors *e = &battery_errors[reg];
+		if (e->reads > 1) // more than one read means there was an error
+		{
+			printf ("%s: %lu reads, %lu nack, %lu timeout, %lu PEC, %lu range\n",
+				battery_regs[reg].name, e->reads, e->nack, e->timeout, e->pec, e->range);
+		}
 	}
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	go_0(data); // data low
-	delayMicroseconds(quarter * 90);
 }
-//
-void sendrptstart(void) // send repeated start condition
-{				
-	go_z(data); // data high
-	delayMicroseconds(quarter * 8);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(data); // data low
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter * 16);
-}
-//
-int read16(void) // read low and high bytes
-{
-	int readval = 0x00; // initialize read word to zero
-	// bit 7 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0080;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 6 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0040;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 5 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0020;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 4 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0010;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 3 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0008;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 2 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0004;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 1 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0002;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 0 of low byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0001;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// ack/nack of low byte
-	delayMicroseconds(quarter * 2);
-	go_0(data); // send ack back to battery
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	go_0(data); // data low
-	delayMicroseconds(quarter * 40);		
-	// bit 7 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x8000;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 6 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x4000;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 5 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x2000;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 4 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x1000;
-	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 3 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+
+// Main program	
+int main(int argc, char *argv[])
+{        
+	int cached = (argc > 1) && (strcmp(argv[1], "--cached") == 0);
+	struct battery_snapshot snap; // registers read in one bus session
+	if (cached) // take the snapshot from monitor_battery instead of the bus
 	{
-		readval = readval | 0x0800;
+		unsigned long count; // snapshot sequence number
+		const struct battery_shm *shm = battery_shm_open();
+		if (!shm)
+		{
+			printf ("monitor_battery is not publishing a snapshot\n");
+			return 1;
+		}
+		if (battery_shm_read(shm, &snap, &count))
+		{
+			printf ("No snapshot available yet\n");
+			return 1;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now); // the snapshot time is wall clock time
+		printf ("Snapshot %lu, %ld seconds old\n", count, (long)(now.tv_sec - snap.time.tv_sec));
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 2 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	else if (argc > 1) // an i2c device such as /dev/i2c-3, or a fake bus file
 	{
-		readval = readval | 0x0400;
+		if (smbus_open_dev(&bus, argv[1]))
+		{
+			printf ("Could not open %s\n", argv[1]);
+			return 1;
+		}
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 1 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
-	{
-		readval = readval | 0x0200;
+	else if (smbus_open(&bus, &smbus_wiringpi, SMBUS_100KHZ, clock_pin, data_pin))
+	{ // setup the GPIO SMBus before data transfer
+		printf ("Could not set up the GPIO pins\n");
+		return 1;
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// bit 0 of high byte
-	go_z(data); 
-	delayMicroseconds(quarter);
-	if (read_pin(data))
+	if (!cached)
 	{
-		readval = readval | 0x0100;
+		battery_init(&bus); // turn on PEC if the battery supports it
+//***************Battery Status**********
+		battery_snapshot(&bus, BAT_TELEMETRY, &snap);
 	}
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	delayMicroseconds(quarter);
-	// ack/nack of high byte
-	delayMicroseconds(quarter * 2);
-	go_z(data); // send nack back to battery
-	delayMicroseconds(quarter);
-	go_z(clock); // clock high
-	delayMicroseconds(quarter * 2);
-	go_0(clock); // clock low
-	go_0(data); // data low
-	delayMicroseconds(quarter * 8);	
-	return readval;
-}
-//
-void stopbus(void) // stop condition, data low when clock goes high
-{
-	go_z(clock); // clock high
-	delayMicroseconds(quarter);	
-	go_z(data);	// data high
-	delayMicroseconds(quarter * 30);	
-}
+	int value; // register value
+	int result; // 0 or the reason a register could not be read
+	int bat_stat = snap.status; //bat_stat printf comes after all the other registers are printed
+	// Only show the other registers if bat_stat is OK
+	if (snap.valid & BAT_MASK(BAT_STATUS))
+	{
+//***************Manufacturer and Chemistry**********
+		if (!cached) // the block registers are not in the snapshot
+		{
+			read_text(0x20, "Manufacturer"); // ManufacturerName block
+			read_text(0x22, "Chemistry"); // DeviceChemistry block
+		}
 
-// Main program	
-int main(void)
-{        
-	setupbus(); // setup before data transfer
-//***************Battery Status**********
-	error = 0; // initialize to no error
-	startbus(); // send start condition
-	send8(0x16); // send battery address 0x16 (0x0b w/ write)
-	send8(0x16); // load register pointer 0x16
-	sendrptstart(); // send repeated start codition				
-	send8(0x17); // send battery address 0x17 (0x0b w/ read)
-	unsigned short bat_stat = read16();
-	stopbus(); // send stop condition
-	if ((bat_stat == 0xffff) | (error))// read again if all 1's or nack
-	{
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x16); // load register pointer 0x16
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		bat_stat = read16();
-		stopbus(); // send stop condition
-	}  //bat_stat printf comes after all the other registers are printed
-	// Only proceed with reading the other registers if bat_stat is OK
-	if (bat_stat != 0xffff)
 //****************Voltage********	
-	{
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x09); // load register pointer 0x09 
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		float bat_voltage = (float)read16()/1000;// convert mvolts to volts
-		stopbus(); // send stop condition
-		// check if out of range or if any NACKs were given by the battery	
-		if ((bat_voltage >= 22) | (bat_voltage <= 6) | (error))
-		{// try again and printf the result (good or bad)
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x09); // load register pointer 0x09 
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			bat_voltage = (float)read16()/1000;// convert mvolts to volts
-			stopbus(); // send stop condition
-			printf ("Voltage =  %6.3f Volts\n", bat_voltage);		  
+		result = snap.result[BAT_VOLTAGE];
+		value = snap.voltage;
+		if ((result == 0) || (result == BATTERY_RANGE))
+		{
+			printf ("Voltage = %6.3f Volts%s\n", (float)value/1000, note(result));// convert mvolts to volts
 		}
 		else
-		{// 1st try was in range and Ack'ed so printf the result 
-			printf ("Voltage = %6.3f Volts\n", bat_voltage);
+		{
+			not_read(BAT_VOLTAGE, result);
 		}
 	
 //***************Current**********
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x0a); // load register pointer 0x0a
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		short bat_current = (short)read16();// signed 16 bit ma current
-		stopbus(); // send stop condition
-		// check if out of range or if any NACKs were given by the battery
-		if ((bat_current >= 3000) | (bat_current <= -3000) | (bat_current == -1) | (error))
-		{// try again and printf the result (good or bad)
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x0a); // load register pointer 0x0a
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			bat_current = (short)read16();// signed 16 bit ma current
-			stopbus(); // send stop condition
-			printf ("Current =  %d mA\n", bat_current);
+		result = snap.result[BAT_CURRENT];
+		value = snap.current;// signed 16 bit ma current
+		if ((result == 0) || (result == BATTERY_RANGE))
+		{
+			printf ("Current = %d mA%s\n", value, note(result));
 		}
 		else
-		{// 1st try was in range and Ack'ed so printf the result 
-			printf ("Current = %d mA\n", bat_current);
+		{
+			not_read(BAT_CURRENT, result);
 		}
 
 //********Temperature********
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x08); // load register pointer 0x08
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		float temper = (float)read16()/10-273.15;//0.1K unit converted to C
-		stopbus(); // send stop condition
-		if ((temper >= 40) | (error)) // check if out of range or any NACK's 
-		{   // try again and printf the result (good or bad)
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x08); // load register pointer 0x08
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			temper = (float)read16()/10-273.15;//0.1K unit converted to C
-			stopbus(); // send stop condition		
-			printf ("Temperature =  %5.2f degrees C\n", temper);
+		result = snap.result[BAT_TEMPERATURE];
+		value = snap.temperature;
+		if ((result == 0) || (result == BATTERY_RANGE))
+		{
+			printf ("Temperature = %5.2f degrees C%s\n", (float)value/10-273.15, note(result));//0.1K unit converted to C
 		}
 		else
-		{// 1st try was in range and Ack'ed so printf the result 
-			printf ("Temperature = %5.2f degrees C\n", temper);
+		{
+			not_read(BAT_TEMPERATURE, result);
 		}
 
 //***************Relative State of Charge**********
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x0d); // load register pointer 0x0d
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		int soc = read16(); //read low&high bytes
-		stopbus(); // send stop condition
-		if ((soc >= 150) | (error)) // check if out of range or any nack's
-		{// try again and printf the result (good or bad)
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x0d); // load register pointer 0x0d
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			soc = read16(); //read low&high bytes
-			stopbus(); // send stop condition
-			printf ("State of Charge =  %d percent\n", soc);
+		result = snap.result[BAT_SOC];
+		value = snap.soc;
+		if ((result == 0) || (result == BATTERY_RANGE))
+		{
+			printf ("State of Charge = %d percent%s\n", value, note(result));
 		}
 		else
-		{// 1st try was in range and Ack'ed so printf the result 
-			printf ("State of Charge = %d percent\n", soc);
+		{
+			not_read(BAT_SOC, result);
 		}
     
 //***************Average Time to Empty**********
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x12); // load register pointer 0x12
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		unsigned int time_to_empty = read16();
-		stopbus(); // send stop condition	
-		if ((time_to_empty <= 1000) & (!error)) // check if in range and ack
+		result = snap.result[BAT_TIME_TO_EMPTY];
+		value = snap.time_to_empty;
+		if ((result == 0) && (value <= 1000)) // don't show bad values when charging
 		{
-			printf ("Time to empty = %d minutes\n", time_to_empty);
-		}
-		else
-		{
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x12); // load register pointer 0x12
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			time_to_empty = read16();
-			stopbus(); // send stop condition	
-			if (time_to_empty <= 1000) //don't show bad values when charging
-			{
-				printf ("Time to empty =  %d minutes\n", time_to_empty);
-			}
+			printf ("Time to empty = %d minutes\n", value);
 		} // Don't show FFFF minutes when at 100% soc and charger hooked up
 		
-		
 //***************Average Time to Full**********
-		error = 0; // initialize to no error
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x13); // load register pointer 0x13
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		unsigned int time_to_full = read16();
-		stopbus(); // send stop condition
-		// check if in range and not zero and ack)
-		if ((time_to_full <= 1000) & (time_to_full != 0) & (!error)) 
-		{
-			printf ("Time to full = %d minutes\n", time_to_full);
-		}
-		else
-		{
-			error = 0; // initialize to no error
-			startbus(); // send start condition
-			send8(0x16); // send battery address 0x16 (0x0b w/ write)
-			send8(0x13); // load register pointer 0x13
-			sendrptstart(); // send repeated start codition				
-			send8(0x17); // send battery address 0x17 (0x0b w/ read)
-			time_to_full = read16();
-			stopbus(); // send stop condition
+		result = snap.result[BAT_TIME_TO_FULL];
+		value = snap.time_to_full;
 		// Don't show FFFF minutes when charger not hooked up
 		// Don't show 0 minutes when at 100 SOC and charger hooked up
-			if ((time_to_full <= 1000) & (time_to_full != 0))  
-			{
-				printf ("Time to full =  %d minutes\n", time_to_full);
-			}
+		if ((result == 0) && (value <= 1000) && (value != 0))
+		{
+			printf ("Time to full = %d minutes\n", value);
 		}
 	
 //************Print Battery Status**********
@@ -679,25 +280,17 @@ int main(void)
 		printf ("Enter the register to read in Hex, ie 0x?? "); 
 		scanf ("%x", &reg_pointer);
 		printf ("0x%02x Register", reg_pointer);// show register to read
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(reg_pointer); // load register pointer
-		sendrptstart(); // send repeated start codition				
-		send8(0x17); // send battery address 0x17 (0x0b w/ read)
-		unsigned int value = read16();
-		stopbus(); // send stop condition
+		value = smbus_read_word(&bus, BATTERY_ADDR, reg_pointer);
 		printf (" = %#06x Hex, %d decimal\n", value, value);
 */
 //*Register Write Example***Sets Remaining Time Alarm reg 0x02 to 10 min
 /*        
-		startbus(); // send start condition
-		send8(0x16); // send battery address 0x16 (0x0b w/ write)
-		send8(0x02); // load register pointer 0x02
-	// Note: there is no repeated start on a write 
-		send8(0x0a); // send low byte of 0x0a = 10 decimal minutes
-		send8(0x00); // send high byte of 0x00	
-		stopbus(); // send stop condition
+		smbus_write_word(&bus, BATTERY_ADDR, 0x02, 0x000a); // 0x000a = 10 decimal minutes
 */
+		if (!cached)
+		{
+			print_errors(); // show any registers that needed more than one read
+		}
     }
     else    // the bat_stat read was FFFF so no battery communication
     {
@@ -0,0 +1,229 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// This program decodes the battery history that monitor_battery.c keeps
+// in its ring file (see battery_log.h) and sums up each discharge:
+//   duration and state of charge used, with the drain rate in %/hour
+//   charge (mAh) and energy (Wh) taken out, from current and voltage
+//   capacity, the charge that a full 100% discharge would give at that rate
+// The capacity of the first and last discharge gives the capacity fade.
+// Discharges under 10% are listed but not used for capacity.
+//
+// Use: read_battery_log [-v] [-s "YYYY-MM-DD HH:MM"] [-e "YYYY-MM-DD HH:MM"] [file]
+//   -v  print every sample
+//   -s  start of the time range, -e end of the time range
+// The file is /var/log/battery.ring if none is given. It does not need
+// root and can be run while the monitor is writing.
+//
+// Build with: gcc -o read_battery_log read_battery_log.c battery_log.c
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Skip samples without the registers the discharge sums use,
+//                          build without the bus code
+//
+#define _XOPEN_SOURCE 700 // strptime
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "battery_log.h"
+
+#define STAT_DISCHARGING 0x0040 // battery is discharging (charger unplugged)
+#define MAX_GAP 600 // seconds without a sample that ends a discharge (Pi was off)
+#define CAPACITY_SOC 10 // smallest SoC drop used for a capacity figure
+#define NEEDED (BAT_MASK(BAT_STATUS) | BAT_MASK(BAT_VOLTAGE) | BAT_MASK(BAT_CURRENT) | BAT_MASK(BAT_SOC))
+
+// One discharge
+struct discharge {
+	time_t start; // time of the first sample
+	time_t end; // time of the last sample
+	int soc_start; // SoC at the start
+	int soc_end; // SoC at the end
+	double mah; // charge taken out
+	double wh; // energy taken out
+};
+
+// Global variables
+time_t range_start = 0; // first time to use
+time_t range_end = 0; // last time to use, 0 for no limit
+int verbose = 0; // 1 to print every sample
+int in_discharge = 0; // 1 while a discharge is being summed
+struct discharge cur; // discharge being summed
+struct battery_snapshot prev; // last sample in the range
+int have_prev = 0; // 1 once prev is set
+int count = 0; // discharges printed
+long in_range = 0; // samples in the time range
+double first_capacity = 0; // mAh from the first discharge used for capacity
+double last_capacity = 0; // mAh from the last one
+
+// Functions
+void print_time(time_t t, const char *end) // print a local date and time
+{
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", localtime(&t));
+	printf ("%s%s", stamp, end);
+}
+//
+void end_discharge(void) // print the discharge that was being summed
+{
+	double hours = (double)(cur.end - cur.start) / 3600;
+	int used = cur.soc_start - cur.soc_end;
+	in_discharge = 0;
+	if (hours <= 0)
+	{
+		return; // a single sample, nothing to show
+	}
+	count++;
+	print_time(cur.start, " ");
+	printf ("%5.1f h  SoC %3d%% -> %3d%%  %5.1f %%/h  %6.0f mAh  %6.2f Wh",
+		hours, cur.soc_start, cur.soc_end, used / hours, cur.mah, cur.wh);
+	if (used >= CAPACITY_SOC)
+	{
+		double capacity = cur.mah * 100 / used;
+		printf ("  capacity %5.0f mAh", capacity);
+		if (first_capacity == 0)
+		{
+			first_capacity = capacity;
+		}
+		last_capacity = capacity;
+	}
+	printf ("\n");
+}
+//
+// Function to look at each sample from the ring file
+int sample(const struct battery_snapshot *snap, void *arg)
+{
+	time_t t = snap->time.tv_sec;
+	(void)arg;
+	if ((t < range_start) || (range_end && (t > range_end)))
+	{
+		return 0;
+	}
+	if ((snap->valid & NEEDED) != NEEDED)
+	{
+		return 0; // logged before the monitor had read these registers
+	}
+	in_range++;
+	if (verbose)
+	{
+		print_time(t, "");
+		printf (" %5d mV %6d mA %5.1f C %3d%% status %04x\n", snap->voltage, snap->current,
+			(float)snap->temperature / 10 - 273.15, snap->soc, snap->status);
+	}
+	if (in_discharge && (t - prev.time.tv_sec > MAX_GAP))
+	{
+		end_discharge(); // the monitor was not running, don't guess across the gap
+	}
+	if (snap->status & STAT_DISCHARGING)
+	{
+		if (!in_discharge)
+		{
+			memset(&cur, 0, sizeof(cur));
+			cur.start = t;
+			cur.soc_start = snap->soc;
+			in_discharge = 1;
+		}
+		else
+		{
+			// the last current and voltage held until this sample
+			double hours = (double)(t - prev.time.tv_sec) / 3600;
+			cur.mah += -prev.current * hours;
+			cur.wh += -prev.current * hours * prev.voltage / 1e6;
+		}
+		cur.end = t;
+		cur.soc_end = snap->soc;
+	}
+	else if (in_discharge)
+	{
+		end_discharge();
+	}
+	prev = *snap;
+	have_prev = 1;
+	return 0;
+}
+//
+// Function to read a "YYYY-MM-DD HH:MM" local time. Returns -1 if bad.
+time_t parse_time(const char *text)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	const char *end = strptime(text, "%Y-%m-%d %H:%M", &tm);
+	if (!end || *end)
+	{
+		return -1;
+	}
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+// Main program
+int main(int argc, char *argv[])
+{
+	const char *path = "/var/log/battery.ring";
+	int opt;
+	int bad = 0; // set for a bad option
+	while ((opt = getopt(argc, argv, "vs:e:")) != -1)
+	{
+		if (opt == 'v')
+		{
+			verbose = 1;
+		}
+		else if (opt == 's')
+		{
+			range_start = parse_time(optarg);
+			bad |= (range_start < 0);
+		}
+		else if (opt == 'e')
+		{
+			range_end = parse_time(optarg);
+			bad |= (range_end < 0);
+		}
+		else
+		{
+			bad = 1;
+		}
+	}
+	if (bad)
+	{
+		printf ("Use: read_battery_log [-v] [-s \"YYYY-MM-DD HH:MM\"] [-e \"YYYY-MM-DD HH:MM\"] [file]\n");
+		return 1;
+	}
+	if (optind < argc)
+	{
+		path = argv[optind];
+	}
+	if (battery_log_read(path, sample, 0) < 0)
+	{
+		printf ("Could not read %s\n", path);
+		return 1;
+	}
+	if (in_discharge)
+	{
+		end_discharge(); // still discharging at the end of the range
+	}
+	printf ("%ld samples", in_range);
+	if (have_prev)
+	{
+		printf (", last at ");
+		print_time(prev.time.tv_sec, "");
+	}
+	printf (", %d discharges\n", count);
+	if ((first_capacity > 0) && (last_capacity != first_capacity))
+	{
+		printf ("Capacity fade %.1f%% (%.0f mAh to %.0f mAh)\n",
+			(first_capacity - last_capacity) * 100 / first_capacity,
+			first_capacity, last_capacity);
+	}
+	return 0;
+}
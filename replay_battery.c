@@ -0,0 +1,265 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// This program feeds the battery history that monitor_battery.c keeps
+// (see battery_log.h) through the time to cutoff estimator in
+// battery_estimate.c, so a change to the estimator can be tried on real
+// discharges before it runs on the laptop. For each discharge it prints,
+// in minutes from the start of the discharge:
+//   end     last sample of the discharge
+//   cutoff  first sample under BATTERY_CUTOFF_MV, if the trace got there
+//   soc     warning, blink and shutdown of the old 10/7/5% SoC rule
+//   est     warning, blink and shutdown from the estimator
+// and the minutes of running time the estimator gains over the SoC rule.
+// BROWNOUT is shown for a rule that would have shut down after the cutoff,
+// and SKIPPED if the estimator went up more than one level on a check (it
+// must pass warning and blink on the way to shutdown).
+// When the trace reaches the cutoff, the average error of the prediction
+// over the last hour is shown as well.
+//
+// The best traces run down to the cutoff, for example recorded by
+// monitor_battery with -l on a bench supply load with the Pi's shutdown
+// turned off.
+//
+// Use: replay_battery [-v] [file]    -v prints every prediction
+// The file is /var/log/battery.ring if none is given.
+//
+// Build with: gcc -o replay_battery replay_battery.c battery_estimate.c battery_log.c
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Check that the estimator passes each level in order
+// Rev 1.2 - Oct 17, 2026 - Build without the bus code
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "battery_estimate.h"
+#include "battery_log.h"
+
+#define STAT_DISCHARGING 0x0040 // battery is discharging (charger unplugged)
+#define MAX_GAP 600 // seconds without a sample that ends a discharge (Pi was off)
+#define ERROR_WINDOW 3600 // seconds before the cutoff used for the prediction error
+
+// One prediction, kept to compare with the real cutoff time
+struct prediction {
+	time_t time; // sample time
+	int minutes; // predicted minutes to cutoff, -1 if none
+};
+
+// Global variables
+int verbose = 0; // 1 to print every prediction
+int in_discharge = 0; // 1 while a discharge is being replayed
+struct battery_estimate est; // estimator under test
+time_t start; // first sample of the discharge
+time_t last; // last sample of the discharge
+time_t cutoff; // first sample under the cutoff voltage, 0 if none
+time_t soc_act[BATTERY_SHUTDOWN + 1]; // time of each SoC rule action, 0 if none
+time_t est_act[BATTERY_SHUTDOWN + 1]; // time of each estimator action, 0 if none
+int old_soc; // soc on the last sample, for the SoC rule
+int est_level; // estimator level on the last sample
+int est_skipped; // 1 if the estimator went up more than one level on a sample
+struct prediction *predictions; // predictions in this discharge
+int num_predictions; // predictions used
+int max_predictions; // predictions allocated
+int discharges = 0; // discharges printed
+
+// Functions
+void print_act(const char *name, const time_t *act) // print the action times in minutes
+{
+	int level;
+	printf (" %s", name);
+	for (level = BATTERY_WARN; level <= BATTERY_SHUTDOWN; level++)
+	{
+		if (act[level])
+		{
+			printf (" %4ld", (long)(act[level] - start) / 60);
+		}
+		else
+		{
+			printf ("    -");
+		}
+	}
+}
+//
+void end_discharge(void) // print the discharge that was replayed
+{
+	char stamp[32];
+	in_discharge = 0;
+	if (last == start)
+	{
+		return; // a single sample, nothing to show
+	}
+	discharges++;
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", localtime(&start));
+	printf ("%s end %4ld", stamp, (long)(last - start) / 60);
+	if (cutoff)
+	{
+		printf ("  cutoff %4ld", (long)(cutoff - start) / 60);
+	}
+	else
+	{
+		printf ("  cutoff    -");
+	}
+	print_act(" soc", soc_act);
+	print_act(" est", est_act);
+	if (soc_act[BATTERY_SHUTDOWN] && est_act[BATTERY_SHUTDOWN])
+	{
+		printf ("  gain %+ld", (long)(est_act[BATTERY_SHUTDOWN] - soc_act[BATTERY_SHUTDOWN]) / 60);
+	}
+	if (cutoff && (!soc_act[BATTERY_SHUTDOWN] || (soc_act[BATTERY_SHUTDOWN] > cutoff)))
+	{
+		printf ("  soc BROWNOUT");
+	}
+	if (cutoff && (!est_act[BATTERY_SHUTDOWN] || (est_act[BATTERY_SHUTDOWN] > cutoff)))
+	{
+		printf ("  est BROWNOUT");
+	}
+	if (est_skipped)
+	{
+		printf ("  est SKIPPED");
+	}
+	if (cutoff)
+	{
+		double error = 0; // sum of prediction minus the real minutes to cutoff
+		int n = 0;
+		int i;
+		for (i = 0; i < num_predictions; i++)
+		{
+			struct prediction *p = &predictions[i];
+			if ((p->minutes >= 0) && (p->time <= cutoff) && (cutoff - p->time <= ERROR_WINDOW))
+			{
+				error += p->minutes - (double)(cutoff - p->time) / 60;
+				n++;
+			}
+		}
+		if (n)
+		{
+			printf ("  error %+.1f", error / n);
+		}
+	}
+	printf ("\n");
+}
+//
+// Function to replay each sample from the ring file
+int sample(const struct battery_snapshot *snap, void *arg)
+{
+	time_t t = snap->time.tv_sec;
+	(void)arg;
+	if (in_discharge && (t - last > MAX_GAP))
+	{
+		end_discharge(); // the monitor was not running
+	}
+	if (!(snap->status & STAT_DISCHARGING))
+	{
+		if (in_discharge)
+		{
+			end_discharge();
+		}
+		return 0;
+	}
+	if (!in_discharge)
+	{
+		battery_estimate_init(&est);
+		start = t;
+		cutoff = 0;
+		memset(soc_act, 0, sizeof(soc_act));
+		memset(est_act, 0, sizeof(est_act));
+		old_soc = 50;
+		est_level = BATTERY_OK;
+		est_skipped = 0;
+		num_predictions = 0;
+		in_discharge = 1;
+	}
+	last = t;
+	if (!cutoff && (snap->voltage < BATTERY_CUTOFF_MV))
+	{
+		cutoff = t;
+	}
+	// the old monitor's rule, each level needs the SoC on the last check under the one above
+	int soc = snap->soc;
+	int level = ((soc <= 5) && (old_soc <= 8)) ? BATTERY_SHUTDOWN
+		: ((soc <= 7) && (old_soc <= 10)) ? BATTERY_BLINK
+		: ((soc <= 10) && (old_soc <= 13)) ? BATTERY_WARN : BATTERY_OK;
+	old_soc = soc;
+	if (level && !soc_act[level])
+	{
+		soc_act[level] = t;
+	}
+	level = battery_estimate_update(&est, snap);
+	if (level > est_level + 1)
+	{
+		est_skipped = 1;
+	}
+	est_level = level;
+	if (level && !est_act[level])
+	{
+		est_act[level] = t;
+	}
+	if (verbose)
+	{
+		printf ("%6ld min %5d mV %6d mA %3d%%  rest %6.0f mV  slope %6.2f mV/min  R %4.0f mOhm  predict %4d min  level %d\n",
+			(long)(t - start) / 60, snap->voltage, snap->current, soc, est.rest, est.slope,
+			est.resistance, est.minutes, level);
+	}
+	if (num_predictions == max_predictions)
+	{
+		max_predictions = max_predictions ? max_predictions * 2 : 1024;
+		predictions = realloc(predictions, max_predictions * sizeof(*predictions));
+		if (!predictions)
+		{
+			printf ("Out of memory\n");
+			exit(1);
+		}
+	}
+	predictions[num_predictions].time = t;
+	predictions[num_predictions++].minutes = est.minutes;
+	return 0;
+}
+
+// Main program
+int main(int argc, char *argv[])
+{
+	const char *path = "/var/log/battery.ring";
+	int opt;
+	while ((opt = getopt(argc, argv, "v")) != -1)
+	{
+		if (opt == 'v')
+		{
+			verbose = 1;
+		}
+		else
+		{
+			printf ("Use: replay_battery [-v] [file]\n");
+			return 1;
+		}
+	}
+	if (optind < argc)
+	{
+		path = argv[optind];
+	}
+	if (battery_log_read(path, sample, 0) < 0)
+	{
+		printf ("Could not read %s\n", path);
+		return 1;
+	}
+	if (in_discharge)
+	{
+		end_discharge(); // still discharging at the end of the file
+	}
+	printf ("%d discharges, times in minutes from the start (warning blink shutdown)\n", discharges);
+	free(predictions);
+	return 0;
+}
@@ -0,0 +1,278 @@
+// Host build of the Teensyduino API used by Keyboard_and_Touchpad.ino.
+//
+// This header takes the place of the Teensy++ 2.0 core when the sketch is compiled
+// on Linux for the simulator. Every call costs a number of 16 MHz cpu cycles on the
+// simulator clock, so the sketch runs with (approximately) the timing it has on the
+// Teensy. The pin, usb, i2c and adc functions are backed by the models in teensy_sim.cpp.
+//
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define EXTERNAL 0
+#define DEFAULT 1
+
+#define F_CPU 16000000UL
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Teensy++ 2.0 pin numbers
+#define PIN_D0 0
+#define PIN_D1 1
+#define PIN_D2 2
+#define PIN_D3 3
+#define PIN_D4 4
+#define PIN_D5 5
+#define PIN_D6 6
+#define PIN_D7 7
+#define PIN_E0 8
+#define PIN_E1 9
+#define PIN_C0 10
+#define PIN_C1 11
+#define PIN_C2 12
+#define PIN_C3 13
+#define PIN_C4 14
+#define PIN_C5 15
+#define PIN_C6 16
+#define PIN_C7 17
+#define PIN_E6 18
+#define PIN_E7 19
+#define PIN_B0 20
+#define PIN_B1 21
+#define PIN_B2 22
+#define PIN_B3 23
+#define PIN_B4 24
+#define PIN_B5 25
+#define PIN_B6 26
+#define PIN_B7 27
+#define PIN_A0 28
+#define PIN_A1 29
+#define PIN_A2 30
+#define PIN_A3 31
+#define PIN_A4 32
+#define PIN_A5 33
+#define PIN_A6 34
+#define PIN_A7 35
+#define PIN_E4 36
+#define PIN_E5 37
+#define SIM_NUM_PINS 46
+
+// Flash tables are ordinary constants on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+// USB key codes from the Teensyduino keylayouts.h
+#define MODIFIERKEY_CTRL        ( 0x01 | 0xE000 )
+#define MODIFIERKEY_SHIFT       ( 0x02 | 0xE000 )
+#define MODIFIERKEY_ALT         ( 0x04 | 0xE000 )
+#define MODIFIERKEY_GUI         ( 0x08 | 0xE000 )
+#define MODIFIERKEY_RIGHT_CTRL  ( 0x10 | 0xE000 )
+#define MODIFIERKEY_RIGHT_SHIFT ( 0x20 | 0xE000 )
+#define MODIFIERKEY_RIGHT_ALT   ( 0x40 | 0xE000 )
+#define MODIFIERKEY_RIGHT_GUI   ( 0x80 | 0xE000 )
+
+#define KEY_A           (   4  | 0xF000 )
+#define KEY_B           (   5  | 0xF000 )
+#define KEY_C           (   6  | 0xF000 )
+#define KEY_D           (   7  | 0xF000 )
+#define KEY_E           (   8  | 0xF000 )
+#define KEY_F           (   9  | 0xF000 )
+#define KEY_G           (  10  | 0xF000 )
+#define KEY_H           (  11  | 0xF000 )
+#define KEY_I           (  12  | 0xF000 )
+#define KEY_J           (  13  | 0xF000 )
+#define KEY_K           (  14  | 0xF000 )
+#define KEY_L           (  15  | 0xF000 )
+#define KEY_M           (  16  | 0xF000 )
+#define KEY_N           (  17  | 0xF000 )
+#define KEY_O           (  18  | 0xF000 )
+#define KEY_P           (  19  | 0xF000 )
+#define KEY_Q           (  20  | 0xF000 )
+#define KEY_R           (  21  | 0xF000 )
+#define KEY_S           (  22  | 0xF000 )
+#define KEY_T           (  23  | 0xF000 )
+#define KEY_U           (  24  | 0xF000 )
+#define KEY_V           (  25  | 0xF000 )
+#define KEY_W           (  26  | 0xF000 )
+#define KEY_X           (  27  | 0xF000 )
+#define KEY_Y           (  28  | 0xF000 )
+#define KEY_Z           (  29  | 0xF000 )
+#define KEY_1           (  30  | 0xF000 )
+#define KEY_2           (  31  | 0xF000 )
+#define KEY_3           (  32  | 0xF000 )
+#define KEY_4           (  33  | 0xF000 )
+#define KEY_5           (  34  | 0xF000 )
+#define KEY_6           (  35  | 0xF000 )
+#define KEY_7           (  36  | 0xF000 )
+#define KEY_8           (  37  | 0xF000 )
+#define KEY_9           (  38  | 0xF000 )
+#define KEY_0           (  39  | 0xF000 )
+#define KEY_ENTER       (  40  | 0xF000 )
+#define KEY_ESC         (  41  | 0xF000 )
+#define KEY_BACKSPACE   (  42  | 0xF000 )
+#define KEY_TAB         (  43  | 0xF000 )
+#define KEY_SPACE       (  44  | 0xF000 )
+#define KEY_MINUS       (  45  | 0xF000 )
+#define KEY_EQUAL       (  46  | 0xF000 )
+#define KEY_LEFT_BRACE  (  47  | 0xF000 )
+#define KEY_RIGHT_BRACE (  48  | 0xF000 )
+#define KEY_BACKSLASH   (  49  | 0xF000 )
+#define KEY_NON_US_NUM  (  50  | 0xF000 )
+#define KEY_SEMICOLON   (  51  | 0xF000 )
+#define KEY_QUOTE       (  52  | 0xF000 )
+#define KEY_TILDE       (  53  | 0xF000 )
+#define KEY_COMMA       (  54  | 0xF000 )
+#define KEY_PERIOD      (  55  | 0xF000 )
+#define KEY_SLASH       (  56  | 0xF000 )
+#define KEY_CAPS_LOCK   (  57  | 0xF000 )
+#define KEY_F1          (  58  | 0xF000 )
+#define KEY_F2          (  59  | 0xF000 )
+#define KEY_F3          (  60  | 0xF000 )
+#define KEY_F4          (  61  | 0xF000 )
+#define KEY_F5          (  62  | 0xF000 )
+#define KEY_F6          (  63  | 0xF000 )
+#define KEY_F7          (  64  | 0xF000 )
+#define KEY_F8          (  65  | 0xF000 )
+#define KEY_F9          (  66  | 0xF000 )
+#define KEY_F10         (  67  | 0xF000 )
+#define KEY_F11         (  68  | 0xF000 )
+#define KEY_F12         (  69  | 0xF000 )
+#define KEY_PRINTSCREEN (  70  | 0xF000 )
+#define KEY_SCROLL_LOCK (  71  | 0xF000 )
+#define KEY_PAUSE       (  72  | 0xF000 )
+#define KEY_INSERT      (  73  | 0xF000 )
+#define KEY_HOME        (  74  | 0xF000 )
+#define KEY_PAGE_UP     (  75  | 0xF000 )
+#define KEY_DELETE      (  76  | 0xF000 )
+#define KEY_END         (  77  | 0xF000 )
+#define KEY_PAGE_DOWN   (  78  | 0xF000 )
+#define KEY_RIGHT       (  79  | 0xF000 )
+#define KEY_LEFT        (  80  | 0xF000 )
+#define KEY_DOWN        (  81  | 0xF000 )
+#define KEY_UP          (  82  | 0xF000 )
+#define KEY_NUM_LOCK    (  83  | 0xF000 )
+#define KEYPAD_SLASH    (  84  | 0xF000 )
+#define KEYPAD_ASTERIX  (  85  | 0xF000 )
+#define KEYPAD_MINUS    (  86  | 0xF000 )
+#define KEYPAD_PLUS     (  87  | 0xF000 )
+#define KEYPAD_ENTER    (  88  | 0xF000 )
+#define KEYPAD_1        (  89  | 0xF000 )
+#define KEYPAD_2        (  90  | 0xF000 )
+#define KEYPAD_3        (  91  | 0xF000 )
+#define KEYPAD_4        (  92  | 0xF000 )
+#define KEYPAD_5        (  93  | 0xF000 )
+#define KEYPAD_6        (  94  | 0xF000 )
+#define KEYPAD_7        (  95  | 0xF000 )
+#define KEYPAD_8        (  96  | 0xF000 )
+#define KEYPAD_9        (  97  | 0xF000 )
+#define KEYPAD_0        (  98  | 0xF000 )
+#define KEYPAD_PERIOD   (  99  | 0xF000 )
+
+// Pin functions. Teensyduino turns a constant pin number into a single instruction,
+// so the simulator charges less for those calls.
+void sim_pinMode(uint8_t pin, uint8_t mode, bool constant);
+void sim_digitalWrite(uint8_t pin, uint8_t val, bool constant);
+uint8_t sim_digitalRead(uint8_t pin, bool constant);
+#define pinMode(pin, mode) sim_pinMode((pin), (mode), __builtin_constant_p(pin))
+#define digitalWrite(pin, val) sim_digitalWrite((pin), (val), __builtin_constant_p(pin))
+#define digitalRead(pin) sim_digitalRead((pin), __builtin_constant_p(pin))
+
+int analogRead(uint8_t channel);
+void analogReference(uint8_t mode);
+
+void delay(uint32_t ms);
+void delayMicroseconds(uint16_t us);
+uint32_t millis(void);
+uint32_t micros(void);
+
+void _restart_Teensyduino_(void);
+
+// Interrupts. The simulator runs an interrupt handler between two calls of the sketch,
+// and charges its cycles to the code it interrupted.
+void cli(void);
+void sei(void);
+#define noInterrupts() cli()
+#define interrupts() sei()
+#define ISR(vector) extern "C" void vector(void)
+
+// Pin change interrupt 0 (port B) registers of the AT90USB1286
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCMSK0;
+#define PCIE0 0
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define PCINT3 3
+#define PCINT0_vect sim_pcint0_vect
+
+// Timer 1 registers of the AT90USB1286. The simulator runs the timer in CTC mode (WGM12 set) with the
+// clock select bits of TCCR1B as the prescaler. It counts whether or not the compare A interrupt is on,
+// a match with the interrupt off stays pending until it is turned on. TCNT1 is read from and written to
+// the simulated time.
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+extern volatile uint16_t OCR1A;
+struct sim_timer1_count {
+  sim_timer1_count &operator=(uint16_t count);
+  operator uint16_t() const;
+};
+extern sim_timer1_count TCNT1;
+#define WGM12 3
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE1A 1
+#define TIMER1_COMPA_vect sim_timer1_compa_vect
+
+extern volatile uint8_t keyboard_leds;
+
+// elapsedMillis from the Teensyduino core
+class elapsedMillis {
+ private:
+  uint32_t ms;
+ public:
+  elapsedMillis(void) { ms = millis(); }
+  elapsedMillis(uint32_t val) { ms = millis() - val; }
+  operator uint32_t () const { return millis() - ms; }
+  elapsedMillis & operator = (uint32_t val) { ms = millis() - val; return *this; }
+};
+
+// USB keyboard and mouse. The simulated host polls both endpoints once per 1 ms usb frame.
+class usb_keyboard_class {
+ public:
+  void set_modifier(uint8_t c);
+  void set_key1(uint8_t c);
+  void set_key2(uint8_t c);
+  void set_key3(uint8_t c);
+  void set_key4(uint8_t c);
+  void set_key5(uint8_t c);
+  void set_key6(uint8_t c);
+  void send_now(void);
+};
+extern usb_keyboard_class Keyboard;
+
+class usb_mouse_class {
+ public:
+  void move(int8_t x, int8_t y, int8_t wheel = 0);
+  void set_buttons(uint8_t left, uint8_t middle = 0, uint8_t right = 0);
+};
+extern usb_mouse_class Mouse;
+
+#endif
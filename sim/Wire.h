@@ -0,0 +1,22 @@
+// Host build of the Teensyduino Wire (i2c slave) library for the simulator.
+// The i2c master on the other side of the bus is the Pi, played by the simulator script.
+//
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include "Arduino.h"
+
+class TwoWire {
+ public:
+  void begin(uint8_t address);
+  void onReceive(void (*function)(int));
+  void onRequest(void (*function)(void));
+  int available(void);
+  int read(void);
+  size_t write(uint8_t data);
+  size_t write(const char *str);
+  size_t write(const uint8_t *data, size_t quantity);
+};
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,3 @@
+// Builds Keyboard_and_Touchpad.ino as a C++ file for the simulator
+#include "Arduino.h"
+#include "../Keyboard_and_Touchpad.ino"
@@ -0,0 +1,1184 @@
+// Linux simulator for the Teensy++ 2.0 keyboard and touchpad controller.
+//
+// The sketch is compiled against Arduino.h and Wire.h in this folder and runs its
+// setup() and loop() on a simulated 16 MHz clock. The simulator models the parts
+// of the laptop that the Teensy talks to:
+//   - the 16 x 8 keyboard matrix on Row0-Row15 and Col0-Col7 (rows need a few usec to settle)
+//   - a ps/2 touchpad on TP_CLK and TP_DATA that answers the commands the sketch sends
+//   - the usb host, which collects one keyboard and one mouse report per 1 msec frame
+//   - the Pi as i2c master talking to the sketch at address 8
+//   - the battery voltage on ADC channel 0
+//   - the LCD control card, LED, reset and shutdown outputs (traced when they change)
+//   - timer 1 in CTC mode with its compare A interrupt
+//
+// Input is a script of timed events (see example.txt). Output is a trace with the cpu
+// cycle count of every usb report, i2c transfer and output pin change, followed by a
+// summary of the loop() timing and the key press and touchpad to usb report latency.
+//
+// Usage: teensy_sim [-v] [-q] script.txt
+//   -v  also trace every pass through loop() and every byte on the touchpad bus
+//   -q  only print the summary
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Wire.h"
+
+void setup();
+void loop();
+
+// ---------------------------------------------------------------- clock and trace
+static uint64_t now; // cpu cycles since power up
+static uint64_t end_time = 10000ULL * 16000; // default run time is 10 seconds
+static int in_handler; // set while an interrupt or i2c handler runs (no nested events)
+static uint64_t handler_time; // cycles used by handlers, taken from the code they interrupted
+static bool quiet;
+static bool trace_loops;
+struct SimEnd {};
+#define US(x) ((uint64_t)(x) * 16) // cycles in x usec
+#define MS(x) ((uint64_t)(x) * 16000) // cycles in x msec
+
+static void trace(const char *fmt, ...)
+{
+  if (quiet) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  printf("%12llu cyc %11.3f ms  ", (unsigned long long)now, now / 16000.0);
+  vprintf(fmt, args);
+  printf("\n");
+  va_end(args);
+}
+
+static void run_events(uint64_t until);
+
+// Spend cpu cycles. Anything the models have scheduled in that time happens on the way.
+static void spend(uint64_t cycles)
+{
+  if (in_handler) {
+    now += cycles;
+    handler_time += cycles;
+    return;
+  }
+  uint64_t target = now + cycles;
+  run_events(target);
+  while (handler_time) { // the interrupted code finishes later by the time the handlers took
+    target += handler_time;
+    handler_time = 0;
+    run_events(target);
+  }
+  now = target;
+  if (now >= end_time) {
+    throw SimEnd();
+  }
+}
+
+// Internal events of the models (script events, host actions)
+static std::multimap<uint64_t, void (*)(void)> timed;
+
+// ---------------------------------------------------------------- wiring of the Teensy
+static const uint8_t row_pin[16] = {PIN_D3, PIN_D4, PIN_D5, PIN_E5, PIN_D7, PIN_E1, PIN_C0, PIN_A4,
+                                    PIN_C3, PIN_A1, PIN_C5, PIN_A2, PIN_C6, PIN_A7, PIN_C7, PIN_A3};
+static const uint8_t col_pin[8] = {PIN_E0, PIN_E4, PIN_C1, PIN_A0, PIN_C2, PIN_A5, PIN_C4, PIN_A6};
+static const uint8_t tp_clk_pin = PIN_B2;
+static const uint8_t tp_data_pin = PIN_B3;
+
+struct Output {
+  uint8_t pin;
+  const char *name;
+};
+static const Output outputs[] = {
+  {PIN_B7, "Vol_Up"}, {PIN_B6, "Vol_Dn"}, {PIN_B5, "Menu"}, {PIN_B4, "On_Off"},
+  {PIN_D6, "BLINK_LED"}, {PIN_B1, "RESET_PI"}, {PIN_B0, "SHUTDOWN"},
+  {PIN_E7, "CAPS_LED"}, {PIN_E6, "DISK_LED"},
+};
+
+// Keys on the KFRMBA151B keyboard by label, with their matrix location and usb usage code
+struct KeyLabel {
+  const char *label;
+  int row;
+  int col;
+  int usage; // 0xe0 + bit for modifiers, 0 for Fn
+};
+static const KeyLabel labels[] = {
+  {"CTRL-R", 0, 2, 0xe0}, {"CTRL-L", 0, 6, 0xe0},
+  {"LEFT", 1, 1, 80}, {"DOWN", 1, 2, 81}, {"UP", 1, 3, 82}, {"PAGE-D", 1, 4, 78},
+  {"PAGE-U", 1, 5, 75}, {"END", 1, 6, 77}, {"RIGHT", 1, 7, 79},
+  {"ENTER", 2, 1, 40}, {"]", 2, 3, 48}, {"=", 2, 5, 46}, {"'", 2, 6, 52},
+  {"F12", 3, 0, 69}, {"MENU", 3, 1, 70}, {"/", 3, 2, 56}, {";", 3, 3, 51}, {"[", 3, 4, 47},
+  {"P", 3, 5, 19}, {"-", 3, 6, 45}, {"BCKSPACE", 3, 7, 42},
+  {"INSERT", 4, 0, 73}, {"\\", 4, 4, 49}, {"HOME", 4, 5, 74}, {"L", 4, 6, 15}, {"DELETE", 4, 7, 76},
+  {"F10", 5, 0, 67}, {"COMMA", 5, 1, 54}, {"PERIOD", 5, 2, 55}, {"I", 5, 3, 12}, {"0", 5, 4, 39},
+  {"9", 5, 5, 38}, {"F", 5, 6, 9}, {"F11", 5, 7, 68},
+  {"F8", 6, 0, 65}, {"M", 6, 1, 16}, {"B", 6, 2, 5}, {"8", 6, 3, 37}, {"U", 6, 4, 24},
+  {"O", 6, 5, 18}, {"J", 6, 6, 13}, {"F9", 6, 7, 66},
+  {"F7", 7, 0, 64}, {"N", 7, 1, 17}, {"G", 7, 2, 10}, {"Y", 7, 3, 28}, {"K", 7, 4, 14},
+  {"7", 7, 5, 36}, {"H", 7, 6, 11}, {"6", 7, 7, 35},
+  {"F5", 8, 0, 62}, {"V", 8, 1, 25}, {"S", 8, 2, 22}, {"T", 8, 3, 23}, {"R", 8, 4, 21},
+  {"5", 8, 5, 34}, {"C", 8, 6, 6}, {"F6", 8, 7, 63},
+  {"F3", 9, 0, 60}, {"X", 9, 1, 27}, {"E", 9, 3, 8}, {"4", 9, 4, 33}, {"3", 9, 5, 32},
+  {"D", 9, 6, 7}, {"F4", 9, 7, 61},
+  {"F1", 10, 0, 58}, {"Z", 10, 1, 29}, {"SPACE", 10, 2, 44}, {"Q", 10, 3, 20}, {"2", 10, 4, 31},
+  {"1", 10, 5, 30}, {"W", 10, 6, 26}, {"F2", 10, 7, 59},
+  {"SHIFT-L", 11, 5, 0xe1}, {"SHIFT-R", 11, 7, 0xe1},
+  {"~", 12, 0, 53}, {"A", 12, 2, 4}, {"TAB", 12, 4, 43}, {"CAPS", 12, 5, 57}, {"ESC", 12, 7, 41},
+  {"ALT-R", 13, 1, 0xe2}, {"ALT-L", 13, 3, 0xe2},
+  {"GUI", 14, 4, 0xe3},
+  {"Fn", 15, 0, 0},
+};
+
+// ---------------------------------------------------------------- pins and keyboard matrix
+static uint8_t pin_mode[SIM_NUM_PINS];
+static uint8_t pin_out[SIM_NUM_PINS];
+static bool key_down[16][8];
+static uint64_t row_changed_at[16]; // when the row was last driven low or released
+static uint64_t settle = US(3); // time for a column to follow its row
+static uint64_t key_changed_at[16][8]; // when the key was last pressed or released
+static uint64_t bounce; // time a key contact chatters after it changes (0 = clean contacts)
+volatile uint8_t keyboard_leds;
+
+static bool host_low(uint8_t pin)
+{
+  return (pin_mode[pin] == OUTPUT) && !pin_out[pin];
+}
+
+static int row_of(uint8_t pin)
+{
+  for (int r = 0; r < 16; r++) {
+    if (row_pin[r] == pin) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+static int col_of(uint8_t pin)
+{
+  for (int c = 0; c < 8; c++) {
+    if (col_pin[c] == pin) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+// A row pulls the columns low once it has been driven low for the settle time,
+// and keeps pulling them for the settle time after it is released.
+static bool row_active(int r)
+{
+  bool settled = now - row_changed_at[r] >= settle;
+  return host_low(row_pin[r]) ? settled : !settled;
+}
+
+// A key contact chatters for the bounce time after it changes. It is open or closed at random
+// in each 100 usec (the same pattern on every run).
+static bool contact_closed(int r, int c)
+{
+  uint64_t since = now - key_changed_at[r][c];
+  if (since < bounce) {
+    uint32_t slot = (uint32_t)(since / US(100)) + r * 131 + c * 17 + (uint32_t)(key_changed_at[r][c] / US(100));
+    return ((slot * 2654435761u) >> 31) ? !key_down[r][c] : key_down[r][c];
+  }
+  return key_down[r][c];
+}
+
+struct Touchpad;
+static bool tp_clk_level(void);
+static bool tp_data_level(void);
+static void tp_lines_changed(void);
+
+static uint8_t pin_level(uint8_t pin)
+{
+  if (pin == tp_clk_pin) {
+    return tp_clk_level();
+  }
+  if (pin == tp_data_pin) {
+    return tp_data_level();
+  }
+  if (host_low(pin)) {
+    return LOW;
+  }
+  int c = col_of(pin);
+  if (c >= 0) {
+    for (int r = 0; r < 16; r++) {
+      if (contact_closed(r, c) && row_active(r)) {
+        return LOW;
+      }
+    }
+  }
+  if (pin_mode[pin] == OUTPUT) {
+    return pin_out[pin];
+  }
+  return HIGH; // pullup in the Teensy or on the other board
+}
+
+static void pin_changed(uint8_t pin, bool was_low)
+{
+  bool is_low = host_low(pin);
+  if (was_low == is_low) {
+    return;
+  }
+  int r = row_of(pin);
+  if (r >= 0) {
+    row_changed_at[r] = now;
+  }
+  if ((pin == tp_clk_pin) || (pin == tp_data_pin)) {
+    tp_lines_changed();
+  }
+  for (const Output &o : outputs) {
+    if (o.pin == pin) {
+      trace("pin %-9s %s", o.name, is_low ? "low" : (pin_mode[pin] == OUTPUT ? "high" : "hi-z"));
+      if ((pin == PIN_B0) && !is_low && (pin_mode[pin] == OUTPUT)) {
+        trace("power off");
+        throw SimEnd();
+      }
+    }
+  }
+}
+
+void sim_pinMode(uint8_t pin, uint8_t mode, bool constant)
+{
+  spend(constant ? 2 : 50);
+  bool was_low = host_low(pin);
+  pin_mode[pin] = (mode == OUTPUT) ? OUTPUT : INPUT;
+  if (mode == INPUT_PULLUP) {
+    pin_out[pin] = HIGH;
+  }
+  pin_changed(pin, was_low);
+}
+
+void sim_digitalWrite(uint8_t pin, uint8_t val, bool constant)
+{
+  spend(constant ? 2 : 50);
+  bool was_low = host_low(pin);
+  pin_out[pin] = val ? HIGH : LOW;
+  pin_changed(pin, was_low);
+}
+
+uint8_t sim_digitalRead(uint8_t pin, bool constant)
+{
+  spend(constant ? 2 : 40);
+  return pin_level(pin);
+}
+
+// ---------------------------------------------------------------- interrupts
+volatile uint8_t PCICR, PCMSK0;
+extern "C" void sim_pcint0_vect(void) __attribute__((weak));
+static bool irq_enabled = true;
+static bool pcint_flag; // PCIF0, set by a change on an enabled pin until the handler runs
+static unsigned pcint_count;
+
+// Runs the pin change handler if its flag is set and interrupts are on
+static void pcint_dispatch(void)
+{
+  if (!irq_enabled || !pcint_flag || !(PCICR & (1 << PCIE0)) || !sim_pcint0_vect) {
+    return;
+  }
+  pcint_flag = false;
+  pcint_count++;
+  uint64_t start = now; // the models keep their own timing, the handler's time is paid by the main program
+  in_handler++;
+  bool saved = irq_enabled;
+  irq_enabled = false; // interrupts are off inside a handler
+  handler_time += 40; // interrupt entry and exit
+  sim_pcint0_vect();
+  irq_enabled = saved;
+  in_handler--;
+  now = start;
+}
+
+// A port B pin changed level. Port B pins are PIN_B0 to PIN_B7.
+static void pcint_pin_changed(uint8_t pin)
+{
+  if ((pin >= PIN_B0) && (pin <= PIN_B7) && (PCMSK0 & (1 << (pin - PIN_B0)))) {
+    pcint_flag = true;
+    pcint_dispatch();
+  }
+}
+
+// Timer 1 in CTC mode: a compare match comes every (OCR1A + 1) * prescaler cycles
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t OCR1A;
+sim_timer1_count TCNT1;
+extern "C" void sim_timer1_compa_vect(void) __attribute__((weak));
+static uint64_t timer1_next; // time of the next compare match, 0 = timer stopped
+static bool timer1_flag; // OCF1A, set by a compare match until the handler runs
+static unsigned timer1_count;
+static const unsigned timer1_prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+// Cycles between compare matches, 0 when the timer is stopped
+static uint64_t timer1_period(void)
+{
+  if (!(TCCR1B & (1 << WGM12)) || !sim_timer1_compa_vect) {
+    return 0;
+  }
+  return (uint64_t)(OCR1A + 1) * timer1_prescale[TCCR1B & 7];
+}
+
+// Writing the count moves the next compare match
+sim_timer1_count &sim_timer1_count::operator=(uint16_t count)
+{
+  uint64_t period = timer1_period();
+  if (period) {
+    timer1_next = now + period - (uint64_t)count * timer1_prescale[TCCR1B & 7];
+  }
+  return *this;
+}
+
+// The count is the time since the last compare match
+sim_timer1_count::operator uint16_t() const
+{
+  uint64_t period = timer1_period();
+  if (!period || !timer1_next) {
+    return 0;
+  }
+  return (uint16_t)((now + period - timer1_next) / timer1_prescale[TCCR1B & 7]);
+}
+
+// Runs the timer 1 compare handler if its flag is set and its interrupt and interrupts are on
+static void timer1_dispatch(void)
+{
+  if (!irq_enabled || !timer1_flag || !(TIMSK1 & (1 << OCIE1A))) {
+    return;
+  }
+  timer1_flag = false;
+  timer1_count++;
+  uint64_t start = now;
+  in_handler++;
+  bool saved = irq_enabled;
+  irq_enabled = false;
+  handler_time += 40;
+  sim_timer1_compa_vect();
+  irq_enabled = saved;
+  in_handler--;
+  now = start;
+}
+
+// Compare match: flag the interrupt and start the next period
+static void timer1_match(void)
+{
+  timer1_next = timer1_next + timer1_period();
+  timer1_flag = true;
+  timer1_dispatch();
+}
+
+void cli(void)
+{
+  spend(1);
+  irq_enabled = false;
+}
+
+void sei(void)
+{
+  spend(1);
+  irq_enabled = true;
+  pcint_dispatch(); // the pin change interrupt has the higher priority
+  timer1_dispatch();
+}
+
+// ---------------------------------------------------------------- ps/2 touchpad
+struct TxByte {
+  uint8_t data;
+  uint64_t ready; // earliest time the device starts sending it
+};
+struct Touchpad {
+  bool clk_low; // device drives clock low
+  bool data_low; // device drives data low
+  enum { IDLE, TX, RX } state;
+  std::deque<TxByte> txq;
+  int bit; // bit number within the frame
+  int phase;
+  uint64_t next; // time of the next clock edge, 0 = nothing scheduled
+  uint64_t clk_high_since;
+  uint16_t frame;
+  bool expect_arg;
+  uint8_t last_cmd;
+  bool remote;
+  bool reporting;
+  int rate;
+  int dx, dy; // movement not yet reported
+  uint8_t buttons, sent_buttons;
+  uint64_t next_sample;
+  unsigned bytes_sent, bytes_received, aborts;
+};
+static Touchpad tp;
+
+static bool tp_clk_level(void)
+{
+  return !(host_low(tp_clk_pin) || tp.clk_low);
+}
+
+static bool tp_data_level(void)
+{
+  return !(host_low(tp_data_pin) || tp.data_low);
+}
+
+static void tp_queue(uint8_t data, uint64_t delay)
+{
+  tp.txq.push_back({data, now + delay});
+}
+
+static void tp_packet(void)
+{
+  int dx = tp.dx, dy = tp.dy;
+  uint8_t status = 0x08 | tp.buttons;
+  if ((dx > 255) || (dx < -256)) {
+    status |= 0x40; // x overflow
+    dx = dx > 0 ? 255 : -256;
+  }
+  if ((dy > 255) || (dy < -256)) {
+    status |= 0x80; // y overflow
+    dy = dy > 0 ? 255 : -256;
+  }
+  if (dx < 0) {
+    status |= 0x10;
+  }
+  if (dy < 0) {
+    status |= 0x20;
+  }
+  tp_queue(status, US(100));
+  tp_queue(dx & 0xff, US(100));
+  tp_queue(dy & 0xff, US(100));
+  tp.dx = 0;
+  tp.dy = 0;
+  tp.sent_buttons = tp.buttons;
+}
+
+static void tp_command(uint8_t cmd)
+{
+  tp.bytes_received++;
+  if (trace_loops) {
+    trace("touchpad received %02x", cmd);
+  }
+  if (tp.expect_arg) {
+    tp.expect_arg = false;
+    if (tp.last_cmd == 0xf3) {
+      tp.rate = cmd;
+    }
+    tp_queue(0xfa, US(200));
+    return;
+  }
+  tp.last_cmd = cmd;
+  switch (cmd) {
+    case 0xff: // reset, then basic assurance test passed and device id
+      tp.txq.clear();
+      tp.expect_arg = false;
+      tp.remote = false;
+      tp.reporting = false;
+      tp.rate = 100;
+      tp.dx = 0;
+      tp.dy = 0;
+      tp_queue(0xfa, US(200));
+      tp_queue(0xaa, MS(20));
+      tp_queue(0x00, MS(20));
+      break;
+    case 0xe8: // set resolution
+    case 0xf3: // set sample rate
+      tp.expect_arg = true;
+      tp_queue(0xfa, US(200));
+      break;
+    case 0xf0: // remote mode
+      tp.remote = true;
+      tp_queue(0xfa, US(200));
+      break;
+    case 0xea: // stream mode
+      tp.remote = false;
+      tp_queue(0xfa, US(200));
+      break;
+    case 0xf4: // enable data reporting
+      tp.reporting = true;
+      tp_queue(0xfa, US(200));
+      break;
+    case 0xf5: // disable data reporting
+      tp.reporting = false;
+      tp_queue(0xfa, US(200));
+      break;
+    case 0xeb: // read data
+      tp_queue(0xfa, US(200));
+      tp_packet();
+      break;
+    case 0xf2: // get device id
+      tp_queue(0xfa, US(200));
+      tp_queue(0x00, US(200));
+      break;
+    default:
+      tp_queue(0xfa, US(200));
+      break;
+  }
+}
+
+// Work out when the touchpad does something next
+static void tp_schedule(void)
+{
+  if ((tp.state != Touchpad::IDLE) || tp.next) {
+    return;
+  }
+  if (!tp.remote && tp.reporting && (tp.dx || tp.dy || (tp.buttons != tp.sent_buttons))) {
+    if (now >= tp.next_sample) {
+      tp_packet();
+      tp.next_sample = now + MS(1000) / (tp.rate ? tp.rate : 100);
+    }
+    else if (tp.txq.empty()) {
+      tp.next = tp.next_sample;
+      return;
+    }
+  }
+  if (!tp.txq.empty() && tp_clk_level()) {
+    uint64_t start = tp.clk_high_since + US(50); // the bus must be idle for 50 usec
+    if (tp.txq.front().ready > start) {
+      start = tp.txq.front().ready;
+    }
+    tp.next = start > now ? start : now + 1;
+  }
+}
+
+static void tp_lines_changed(void)
+{
+  static bool old_clk = true, old_data = true;
+  bool clk = tp_clk_level();
+  bool data = tp_data_level();
+  if (clk && !old_clk) {
+    tp.clk_high_since = now;
+  }
+  bool clk_changed = clk != old_clk;
+  bool data_changed = data != old_data;
+  old_clk = clk;
+  old_data = data;
+  if (clk_changed) {
+    pcint_pin_changed(tp_clk_pin);
+  }
+  if (data_changed) {
+    pcint_pin_changed(tp_data_pin);
+  }
+  if ((tp.state == Touchpad::TX) && host_low(tp_clk_pin) && (tp.bit < 10)) { // host inhibit aborts the byte
+    tp.state = Touchpad::IDLE;
+    tp.clk_low = false;
+    tp.data_low = false;
+    tp.next = 0;
+    tp.aborts++;
+  }
+  if ((tp.state == Touchpad::IDLE) && !host_low(tp_clk_pin) && host_low(tp_data_pin)) { // request to send
+    tp.state = Touchpad::RX;
+    tp.bit = 0;
+    tp.phase = 1;
+    tp.frame = 0;
+    tp.next = now + US(50);
+    return;
+  }
+  if (tp.state == Touchpad::IDLE) {
+    tp.next = 0;
+    tp_schedule();
+  }
+}
+
+// One clock edge (or the start of a byte) of the touchpad
+static void tp_step(void)
+{
+  tp.next = 0;
+  if (tp.state == Touchpad::IDLE) {
+    if (!tp.txq.empty() && tp_clk_level()) {
+      uint8_t data = tp.txq.front().data;
+      uint8_t parity = 1;
+      for (int i = 0; i < 8; i++) {
+        parity ^= (data >> i) & 1;
+      }
+      tp.frame = (1 << 10) | (parity << 9) | (data << 1); // start 0, data lsb first, odd parity, stop 1
+      tp.state = Touchpad::TX;
+      tp.bit = 0;
+      tp.phase = 0;
+    }
+    else {
+      tp_schedule();
+      return;
+    }
+  }
+  if (tp.state == Touchpad::TX) {
+    if (tp.phase == 0) { // set the data bit while the clock is high
+      tp.data_low = !((tp.frame >> tp.bit) & 1);
+      tp_lines_changed();
+      tp.phase = 1;
+      tp.next = now + US(5);
+    }
+    else if (tp.phase == 1) { // falling clock, host reads the bit
+      tp.clk_low = true;
+      tp_lines_changed();
+      tp.phase = 2;
+      tp.next = now + US(40);
+    }
+    else { // rising clock
+      tp.clk_low = false;
+      tp_lines_changed();
+      if (++tp.bit == 11) {
+        if (trace_loops) {
+          trace("touchpad sent %02x", tp.txq.front().data);
+        }
+        tp.txq.pop_front();
+        tp.bytes_sent++;
+        tp.data_low = false;
+        tp.state = Touchpad::IDLE;
+        tp.next = 0;
+        tp_lines_changed();
+      }
+      else {
+        tp.phase = 0;
+        tp.next = now + US(35);
+      }
+    }
+    return;
+  }
+  // RX: the device clocks in 8 data bits, parity and stop, then acks
+  if (tp.phase == 1) { // falling clock, host sets the next bit
+    tp.clk_low = true;
+    if (tp.bit == 10) {
+      tp.data_low = true; // ack
+    }
+    tp_lines_changed();
+    tp.phase = 2;
+    tp.next = now + US(40);
+  }
+  else { // rising clock, device reads the bit
+    tp.clk_low = false;
+    if (tp.bit < 10) {
+      tp.frame |= tp_data_level() << tp.bit;
+      tp.bit++;
+      tp.phase = 1;
+      tp.next = now + US(40);
+      tp_lines_changed();
+    }
+    else {
+      tp.data_low = false;
+      tp.state = Touchpad::IDLE;
+      tp_lines_changed();
+      tp_command(tp.frame & 0xff);
+      tp_schedule();
+    }
+  }
+}
+
+// ---------------------------------------------------------------- usb host
+struct Endpoint {
+  bool full; // a report is waiting for the host to collect it
+  uint64_t collect; // start of the frame when the host collects it
+  unsigned reports;
+};
+static Endpoint kbd_ep, mouse_ep;
+static uint8_t kbd_mod, kbd_keys[6];
+static uint8_t host_mod, host_keys[6]; // last keyboard report the host received
+static uint8_t mouse_buttons;
+static long mouse_x, mouse_y;
+
+// Waits until the endpoint buffer is free, like usb_keyboard_send(), then queues a report
+static uint64_t endpoint_send(Endpoint &ep)
+{
+  spend(150);
+  if (ep.full && (ep.collect > now)) {
+    spend(ep.collect - now);
+  }
+  ep.full = true;
+  ep.collect = (now / MS(1) + 1) * MS(1);
+  ep.reports++;
+  return ep.collect;
+}
+
+// Press to report latency. A press waits for the first report that holds its usage code,
+// a release for the first report without it.
+struct Pending {
+  int usage;
+  bool press;
+  uint64_t at;
+};
+static std::vector<Pending> pending;
+struct Latency {
+  uint64_t min, max, total;
+  unsigned count;
+};
+static Latency press_lat = {~0ULL, 0, 0, 0}, release_lat = {~0ULL, 0, 0, 0};
+static Latency pointer_lat = {~0ULL, 0, 0, 0}; // touchpad movement to the first mouse report after it
+static uint64_t pointer_moved_at; // 0 when no movement is waiting for a mouse report
+
+static void add_latency(Latency &l, uint64_t d)
+{
+  l.min = d < l.min ? d : l.min;
+  l.max = d > l.max ? d : l.max;
+  l.total += d;
+  l.count++;
+}
+
+static bool report_has(int usage)
+{
+  if (usage >= 0xe0) {
+    return (host_mod >> (usage - 0xe0)) & 1;
+  }
+  for (int i = 0; i < 6; i++) {
+    if (host_keys[i] == usage) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void caps_led_toggle(void)
+{
+  keyboard_leds ^= 0x02;
+}
+
+static void host_keyboard_report(uint64_t at)
+{
+  bool caps_before = false;
+  for (int i = 0; i < 6; i++) {
+    caps_before |= host_keys[i] == 57;
+  }
+  host_mod = kbd_mod;
+  memcpy(host_keys, kbd_keys, 6);
+  trace("usb keyboard report  mod=%02x keys=%02x %02x %02x %02x %02x %02x  (host gets it at %.3f ms)",
+        host_mod, host_keys[0], host_keys[1], host_keys[2], host_keys[3], host_keys[4], host_keys[5], at / 16000.0);
+  bool caps_now = false;
+  for (int i = 0; i < 6; i++) {
+    caps_now |= host_keys[i] == 57;
+  }
+  if (caps_now && !caps_before) { // the host answers caps lock with an led output report
+    timed.insert({at + MS(3), caps_led_toggle});
+  }
+  for (size_t i = 0; i < pending.size();) {
+    Pending &p = pending[i];
+    if (report_has(p.usage) == p.press) {
+      add_latency(p.press ? press_lat : release_lat, at - p.at);
+      pending.erase(pending.begin() + i);
+    }
+    else {
+      i++;
+    }
+  }
+}
+
+usb_keyboard_class Keyboard;
+usb_mouse_class Mouse;
+
+void usb_keyboard_class::set_modifier(uint8_t c) { spend(4); kbd_mod = c; }
+void usb_keyboard_class::set_key1(uint8_t c) { spend(4); kbd_keys[0] = c; }
+void usb_keyboard_class::set_key2(uint8_t c) { spend(4); kbd_keys[1] = c; }
+void usb_keyboard_class::set_key3(uint8_t c) { spend(4); kbd_keys[2] = c; }
+void usb_keyboard_class::set_key4(uint8_t c) { spend(4); kbd_keys[3] = c; }
+void usb_keyboard_class::set_key5(uint8_t c) { spend(4); kbd_keys[4] = c; }
+void usb_keyboard_class::set_key6(uint8_t c) { spend(4); kbd_keys[5] = c; }
+
+void usb_keyboard_class::send_now(void)
+{
+  host_keyboard_report(endpoint_send(kbd_ep));
+}
+
+void usb_mouse_class::move(int8_t x, int8_t y, int8_t wheel)
+{
+  uint64_t at = endpoint_send(mouse_ep);
+  mouse_x += x;
+  mouse_y += y;
+  if (pointer_moved_at) {
+    add_latency(pointer_lat, at - pointer_moved_at);
+    pointer_moved_at = 0;
+  }
+  trace("usb mouse report     x=%4d y=%4d buttons=%x  (host gets it at %.3f ms, pointer %ld,%ld)",
+        x, y, mouse_buttons, at / 16000.0, mouse_x, mouse_y);
+  (void)wheel;
+}
+
+void usb_mouse_class::set_buttons(uint8_t left, uint8_t middle, uint8_t right)
+{
+  mouse_buttons = (left ? 1 : 0) | (right ? 2 : 0) | (middle ? 4 : 0);
+  move(0, 0);
+}
+
+// ---------------------------------------------------------------- i2c slave
+TwoWire Wire;
+static void (*on_receive)(int);
+static void (*on_request)(void);
+static std::vector<uint8_t> i2c_rx;
+static size_t i2c_rx_pos;
+static std::vector<uint8_t> i2c_tx;
+
+void TwoWire::begin(uint8_t address) { spend(100); trace("i2c slave address %d", address); }
+void TwoWire::onReceive(void (*function)(int)) { on_receive = function; }
+void TwoWire::onRequest(void (*function)(void)) { on_request = function; }
+int TwoWire::available(void) { return i2c_rx.size() - i2c_rx_pos; }
+
+int TwoWire::read(void)
+{
+  spend(10);
+  return i2c_rx_pos < i2c_rx.size() ? i2c_rx[i2c_rx_pos++] : -1;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  spend(10);
+  if (i2c_tx.size() >= 32) { // the Wire buffer holds 32 bytes
+    return 0;
+  }
+  i2c_tx.push_back(data);
+  return 1;
+}
+
+size_t TwoWire::write(const char *str)
+{
+  return write((const uint8_t *)str, strlen(str));
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+  size_t n = 0;
+  while ((n < quantity) && write(data[n])) {
+    n++;
+  }
+  return n;
+}
+
+static void i2c_master_write(const std::vector<uint8_t> &bytes)
+{
+  std::string hex;
+  char buf[8];
+  for (uint8_t b : bytes) {
+    snprintf(buf, sizeof buf, " %02x", b);
+    hex += buf;
+  }
+  trace("i2c write%s", hex.c_str());
+  if (on_receive) {
+    i2c_rx = bytes;
+    i2c_rx_pos = 0;
+    uint64_t start = now;
+    in_handler++;
+    on_receive(bytes.size());
+    in_handler--;
+    trace("i2c receive handler took %llu cyc", (unsigned long long)(now - start));
+  }
+}
+
+static void i2c_master_read(size_t count)
+{
+  i2c_tx.clear();
+  uint64_t start = now;
+  if (on_request) {
+    in_handler++;
+    on_request();
+    in_handler--;
+  }
+  i2c_tx.resize(count, 0xff); // the master reads 0xff after the slave runs out of data
+  std::string hex, text;
+  char buf[8];
+  for (uint8_t b : i2c_tx) {
+    snprintf(buf, sizeof buf, " %02x", b);
+    hex += buf;
+    text += (b >= 0x20 && b < 0x7f) ? (char)b : '.';
+  }
+  trace("i2c read%s  \"%s\"  (request handler took %llu cyc)", hex.c_str(), text.c_str(),
+        (unsigned long long)(now - start));
+}
+
+// ---------------------------------------------------------------- adc, time and reset
+static int adc_value = 0x300;
+
+int analogRead(uint8_t channel)
+{
+  spend(1700); // 13 adc clocks at 125 kHz plus the call
+  (void)channel;
+  return adc_value;
+}
+
+void analogReference(uint8_t mode) { spend(4); (void)mode; }
+void delay(uint32_t ms) { spend(MS(ms)); }
+void delayMicroseconds(uint16_t us) { spend(US(us)); }
+uint32_t millis(void) { spend(20); return now / MS(1); }
+uint32_t micros(void) { spend(40); return now / US(1); }
+
+void _restart_Teensyduino_(void)
+{
+  trace("teensy restart");
+  throw SimEnd();
+}
+
+// ---------------------------------------------------------------- script
+struct ScriptEvent {
+  uint64_t at;
+  std::string cmd;
+  std::vector<std::string> args;
+};
+static std::vector<ScriptEvent> script;
+static size_t script_pos;
+
+// Finds a key by its label or by <row>,<col>
+static const KeyLabel *find_key(const std::vector<std::string> &args, size_t i, KeyLabel &numeric)
+{
+  if (i >= args.size()) {
+    return NULL;
+  }
+  int row, col;
+  if (sscanf(args[i].c_str(), "%d,%d", &row, &col) == 2) { // <row>,<col>
+    numeric = {"", row, col, -1};
+    return &numeric;
+  }
+  {
+    for (const KeyLabel &k : labels) {
+      if (args[i] == k.label) {
+        return &k;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void set_key(const KeyLabel *k, bool down)
+{
+  if (!k || (k->row < 0) || (k->row > 15) || (k->col < 0) || (k->col > 7)) {
+    fprintf(stderr, "unknown key\n");
+    exit(2);
+  }
+  key_down[k->row][k->col] = down;
+  key_changed_at[k->row][k->col] = now;
+  trace("key %s %s (row %d col %d)", k->label, down ? "pressed" : "released", k->row, k->col);
+  if (k->usage <= 0) {
+    return;
+  }
+  if (down) {
+    pending.push_back({k->usage, true, now});
+    return;
+  }
+  for (size_t i = 0; i < pending.size();) { // a press that never got sent (Fn functions) is dropped
+    if ((pending[i].usage == k->usage) && pending[i].press) {
+      pending.erase(pending.begin() + i);
+    }
+    else {
+      i++;
+    }
+  }
+  if (report_has(k->usage)) {
+    pending.push_back({k->usage, false, now});
+  }
+}
+
+static void key_release_event(void);
+static std::multimap<uint64_t, KeyLabel> tap_releases;
+
+static void key_release_event(void)
+{
+  auto it = tap_releases.begin();
+  if ((it != tap_releases.end()) && (it->first <= now)) {
+    KeyLabel k = it->second;
+    tap_releases.erase(it);
+    set_key(&k, false);
+  }
+}
+
+static void run_script_event(const ScriptEvent &e)
+{
+  KeyLabel numeric;
+  if (e.cmd == "press" || e.cmd == "release") {
+    set_key(find_key(e.args, 0, numeric), e.cmd == "press");
+  }
+  else if (e.cmd == "tap") { // tap <key> <msec>
+    const KeyLabel *k = find_key(e.args, 0, numeric);
+    size_t n = 1;
+    set_key(k, true);
+    uint64_t hold = MS(e.args.size() > n ? atoi(e.args[n].c_str()) : 50);
+    tap_releases.insert({now + hold, *k});
+    timed.insert({now + hold, key_release_event});
+  }
+  else if (e.cmd == "tp") { // tp <dx> <dy> [buttons]
+    tp.dx += atoi(e.args.at(0).c_str());
+    tp.dy += atoi(e.args.at(1).c_str());
+    if (e.args.size() > 2) {
+      tp.buttons = strtoul(e.args[2].c_str(), NULL, 0) & 7;
+    }
+    trace("touchpad moved %s %s", e.args[0].c_str(), e.args[1].c_str());
+    if (!pointer_moved_at) {
+      pointer_moved_at = now;
+    }
+    tp_schedule();
+  }
+  else if (e.cmd == "i2c_write") {
+    std::vector<uint8_t> bytes;
+    for (const std::string &a : e.args) {
+      bytes.push_back(strtoul(a.c_str(), NULL, 0));
+    }
+    i2c_master_write(bytes);
+  }
+  else if (e.cmd == "i2c_read") {
+    i2c_master_read(e.args.empty() ? 32 : atoi(e.args[0].c_str()));
+  }
+  else if (e.cmd == "adc") {
+    adc_value = strtoul(e.args.at(0).c_str(), NULL, 0);
+    trace("battery adc = 0x%03x", adc_value);
+  }
+  else if (e.cmd == "settle") {
+    settle = US(atoi(e.args.at(0).c_str()));
+  }
+  else if (e.cmd == "bounce") {
+    bounce = US(atoi(e.args.at(0).c_str()));
+  }
+  else {
+    fprintf(stderr, "unknown script command %s\n", e.cmd.c_str());
+    exit(2);
+  }
+}
+
+static void load_script(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    exit(2);
+  }
+  char line[256];
+  uint64_t at = 0;
+  while (fgets(line, sizeof line, f)) {
+    char *hash = strchr(line, '#');
+    if (hash) {
+      *hash = 0;
+    }
+    std::vector<std::string> words;
+    for (char *w = strtok(line, " \t\r\n"); w; w = strtok(NULL, " \t\r\n")) {
+      words.push_back(w);
+    }
+    if (words.empty()) {
+      continue;
+    }
+    if (words[0] == "at") { // at <msec>: time of the events that follow
+      at = (uint64_t)(atof(words.at(1).c_str()) * 16000);
+    }
+    else if (words[0] == "end") { // end <msec>: stop the simulation
+      end_time = (uint64_t)(atof(words.at(1).c_str()) * 16000);
+    }
+    else {
+      script.push_back({at, words[0], std::vector<std::string>(words.begin() + 1, words.end())});
+    }
+  }
+  fclose(f);
+}
+
+// ---------------------------------------------------------------- event loop
+static void run_events(uint64_t until)
+{
+  timer1_dispatch(); // a match that came while its interrupt was off
+  for (;;) {
+    uint64_t next = until + 1;
+    int source = -1;
+    if ((script_pos < script.size()) && (script[script_pos].at < next)) {
+      next = script[script_pos].at;
+      source = 0;
+    }
+    if (tp.next && (tp.next < next)) {
+      next = tp.next;
+      source = 1;
+    }
+    if (!timed.empty() && (timed.begin()->first < next)) {
+      next = timed.begin()->first;
+      source = 2;
+    }
+    if (!timer1_period()) {
+      timer1_next = 0;
+    }
+    else if (!timer1_next) {
+      timer1_next = now + timer1_period(); // the timer was just started
+    }
+    if (timer1_next && (timer1_next < next)) {
+      next = timer1_next;
+      source = 3;
+    }
+    if (source < 0) {
+      return;
+    }
+    if (next > now) {
+      now = next;
+    }
+    in_handler++;
+    if (source == 0) {
+      run_script_event(script[script_pos++]);
+    }
+    else if (source == 1) {
+      tp_step();
+    }
+    else if (source == 3) {
+      timer1_match();
+    }
+    else {
+      void (*action)(void) = timed.begin()->second;
+      timed.erase(timed.begin());
+      action();
+    }
+    in_handler--;
+  }
+}
+
+static void print_latency(const char *name, const Latency &l)
+{
+  if (l.count) {
+    printf("%-22s %6u   min %8.3f  avg %8.3f  max %8.3f ms\n", name, l.count, l.min / 16000.0,
+           (double)l.total / l.count / 16000.0, l.max / 16000.0);
+  }
+  else {
+    printf("%-22s %6u\n", name, 0);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-q")) {
+      quiet = true;
+    }
+    else if (!strcmp(argv[i], "-v")) {
+      trace_loops = true;
+    }
+    else {
+      path = argv[i];
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "usage: %s [-v] [-q] script.txt\n", argv[0]);
+    return 2;
+  }
+  load_script(path);
+  for (uint8_t pin = 0; pin < SIM_NUM_PINS; pin++) {
+    pin_out[pin] = HIGH;
+  }
+  uint64_t loops = 0, loop_min = ~0ULL, loop_max = 0, loop_total = 0, setup_time = 0;
+  try {
+    setup();
+    setup_time = now;
+    trace("setup done");
+    for (;;) {
+      uint64_t start = now;
+      loop();
+      uint64_t d = now - start;
+      loops++;
+      loop_total += d;
+      loop_min = d < loop_min ? d : loop_min;
+      loop_max = d > loop_max ? d : loop_max;
+      if (trace_loops) {
+        trace("loop %llu took %.3f ms", (unsigned long long)loops, d / 16000.0);
+      }
+    }
+  }
+  catch (SimEnd &) {
+  }
+  printf("---- summary after %.3f ms ----\n", now / 16000.0);
+  printf("setup                  %10.3f ms\n", setup_time / 16000.0);
+  if (loops) {
+    printf("loop passes            %6llu   min %8.3f  avg %8.3f  max %8.3f ms\n", (unsigned long long)loops,
+           loop_min / 16000.0, (double)loop_total / loops / 16000.0, loop_max / 16000.0);
+  }
+  printf("usb keyboard reports   %6u\n", kbd_ep.reports);
+  printf("usb mouse reports      %6u   pointer at %ld,%ld\n", mouse_ep.reports, mouse_x, mouse_y);
+  printf("touchpad bytes         %6u sent  %u received  %u aborted by host\n", tp.bytes_sent, tp.bytes_received,
+         tp.aborts);
+  printf("pin change interrupts  %6u\n", pcint_count);
+  printf("timer 1 interrupts     %6u\n", timer1_count);
+  print_latency("key press latency", press_lat);
+  print_latency("key release latency", release_lat);
+  print_latency("touchpad latency", pointer_lat);
+  return 0;
+}
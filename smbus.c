@@ -0,0 +1,912 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Bit-bang SMBus master used by the battery programs.
+// SMBus Data and clock are pulled to 3.3 volts with 3K resistors.
+//
+// Every time the master lets the clock go high it waits until the clock
+// really is high, so the battery can hold it low (clock stretching) while
+// it gets the next byte ready. The original programs did not do this and
+// padded each byte with the large write_gap and read_gap delays that were
+// found with a logic analyzer. Those delays are kept in the 25 kHz entry
+// of the timing table; the 100 kHz entry has no padding.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release, bit loops replace the
+//                          unrolled send8 and read16 in the battery programs
+// Rev 1.1 - Oct 17, 2026 - Wait for clock stretching, add 100 kHz timing,
+//                          sample data bits while the clock is high
+// Rev 1.2 - Oct 17, 2026 - Add the i2c-dev and fake file transports
+// Rev 1.3 - Oct 17, 2026 - Add PEC (packet error code) checking
+// Rev 1.4 - Oct 17, 2026 - Add smbus_read_words, a register list in one bus session
+// Rev 1.5 - Oct 17, 2026 - Read the whole fake file, whatever its size, with smbus_file_lines
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <wiringPi.h>
+#include "smbus.h"
+
+// Timing table in microseconds, indexed by enum smbus_speed
+const struct smbus_timing smbus_timings[SMBUS_NUM_SPEEDS] = {
+	// SMBUS_25KHZ - the delays from the original programs, quarter = 10 usec
+	{
+		.start_wait = 1000, // needed when doing multiple reads
+		.start_hold = 10,
+		.start_low = 40,
+		.setup = 10,
+		.high = 20,
+		.low = 10,
+		.ack_wait = 40,
+		.ack_setup = 20,
+		.write_gap = 900,
+		.read_gap = 400,
+		.last_gap = 80,
+		.rpt_setup = 80,
+		.rpt_gap = 160,
+		.stop_gap = 300,
+		.stretch_poll = 5,
+		.stretch_timeout = 25000,
+	},
+	// SMBUS_100KHZ - SMBus minimum times, the battery stretches the clock
+	{
+		.start_wait = 5, // tBUF 4.7 usec
+		.start_hold = 4, // tHD:STA 4.0 usec
+		.start_low = 5,
+		.setup = 3, // setup + low is the 4.7 usec tLOW
+		.high = 5, // tHIGH 4.0 usec
+		.low = 2,
+		.ack_wait = 0,
+		.ack_setup = 0,
+		.write_gap = 0,
+		.read_gap = 0,
+		.last_gap = 0,
+		.rpt_setup = 5, // tSU:STA 4.7 usec
+		.rpt_gap = 5,
+		.stop_gap = 5, // tBUF 4.7 usec
+		.stretch_poll = 2,
+		.stretch_timeout = 25000, // SMBus tTIMEOUT is 25 to 35 msec
+	},
+};
+
+// wiringPi GPIO functions
+static int wiringpi_setup(void)
+{
+	if (wiringPiSetupGpio() != 0) //Init wiringPi using the Broadcom GPIO numbers
+	{
+		return -1;
+	}
+	piHiPri(99); //Make program the highest priority (doesn't help)
+	return 0;
+}
+//
+static void wiringpi_go_z(int pin) // float the pin and let pullup or battery set level
+{
+	pinMode(pin, INPUT); // set pin as input to tri-state the driver
+}
+//
+static void wiringpi_go_0(int pin) // drive the pin low
+{
+	pinMode(pin, OUTPUT); // set pin as output
+	digitalWrite(pin, LOW); // drive pin low
+}
+//
+static int wiringpi_read_pin(int pin) // read the pin and return logic level
+{
+	pinMode(pin, INPUT); // set pin as input
+	return (digitalRead(pin)); // return the logic level
+}
+//
+static void wiringpi_delay_us(unsigned int usec)
+{
+	delayMicroseconds(usec);
+}
+//
+const struct smbus_gpio smbus_wiringpi = {
+	wiringpi_setup,
+	wiringpi_go_z,
+	wiringpi_go_0,
+	wiringpi_read_pin,
+	wiringpi_delay_us,
+};
+
+// Function to add a byte to the SMBus PEC, a CRC-8 with polynomial
+// x^8 + x^2 + x + 1 (0x07) started at zero.
+unsigned char smbus_crc8(unsigned char crc, unsigned char value)
+{
+	int i;
+	crc ^= value;
+	for (i = 0; i < 8; i++)
+	{
+		crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+	}
+	return crc;
+}
+//
+// Function to let the clock go high and wait while the slave holds it low.
+// Returns 0, or SMBUS_TIMEOUT and sets bus->timeout if it never goes high.
+static int clock_high(struct smbus *bus)
+{
+	const struct smbus_gpio *g = bus->gpio;
+	const struct smbus_timing *t = bus->timing;
+	unsigned int waited = 0; // time the clock has been held low
+	g->go_z(bus->clock); // clock high
+	while (!g->read_pin(bus->clock)) // slave is stretching the clock
+	{
+		if (waited >= t->stretch_timeout)
+		{
+			bus->timeout = 1;
+			return SMBUS_TIMEOUT;
+		}
+		g->delay_us(t->stretch_poll);
+		waited += t->stretch_poll;
+	}
+	bus->stretch_us += waited;
+	return 0;
+}
+//
+// Function to send a start condition - data low when clock goes low
+static void start_bus(struct smbus *bus)
+{
+	const struct smbus_gpio *g = bus->gpio;
+	const struct smbus_timing *t = bus->timing;
+	g->delay_us(t->start_wait);
+	g->go_0(bus->data);
+	g->delay_us(t->start_hold);
+	g->go_0(bus->clock);
+	g->delay_us(t->start_low); // wait 1 period before proceeding
+}
+//
+// Function to send a repeated start condition.
+// Returns 0, or SMBUS_TIMEOUT if the slave holds the clock low.
+static int rpt_start(struct smbus *bus)
+{
+	const struct smbus_gpio *g = bus->gpio;
+	const struct smbus_timing *t = bus->timing;
+	g->go_z(bus->data); // data high
+	g->delay_us(t->rpt_setup);
+	if (clock_high(bus))
+	{
+		return SMBUS_TIMEOUT;
+	}
+	g->delay_us(t->high);
+	g->go_0(bus->data); // data low
+	g->delay_us(t->high);
+	g->go_0(bus->clock); // clock low
+	g->delay_us(t->rpt_gap);
+	return 0;
+}
+//
+// Function to send a stop condition - data goes high while clock is high
+static void stop_bus(struct smbus *bus)
+{
+	const struct smbus_gpio *g = bus->gpio;
+	const struct smbus_timing *t = bus->timing;
+	clock_high(bus);
+	g->delay_us(t->setup);
+	g->go_z(bus->data); // data high
+	g->delay_us(t->stop_gap);
+}
+//
+// Function to clock out 8 bits msb first and check the slave ack.
+// Sets bus->nack and returns SMBUS_NACK if the slave does not pull data low,
+// or returns SMBUS_TIMEOUT if the slave holds the clock low.
+static int write_byte(struct smbus *bus, int value)
+{
+	const struct smbus_gpio *g = bus->gpio;
+	const struct smbus_timing *t = bus->timing;
+	int mask;
+	bus->crc = smbus_crc8(bus->crc, value); // every byte on the bus is in the PEC
+	for (mask = 0x80; mask != 0; mask >>= 1) // bit 7 down to bit 0
+	{
+		if (value & mask)
+		{
+			g->go_z(bus->data); // send high
+		}
+		else
+		{
+			g->go_0(bus->data); // send low
+		}
+		g->delay_us(t->setup);
+		if (clock_high(bus))
+		{
+			return SMBUS_TIMEOUT;
+		}
+		g->delay_us(t->high);
+		g->go_0(bus->clock); // clock low
+		g->delay_us(t->low);
+	}
+	// ack/nack
+	g->delay_us(t->ack_wait);
+	g->go_z(bus->data); // float data to see ack
+	g->delay_us(t->setup);
+	if (clock_high(bus))
+	{
+		return SMBUS_TIMEOUT;
+	}
+	// read data to see if the slave sends a low (acknowledge transfer)
+	int nack = g->read_pin(bus->data);
+	g->delay_us(t->high);
+	g->go_0(bus->clock); // clock low
+	g->go_0(bus->data); // data low
+	g->delay_us(t->write_gap);
+	if (nack)
+	{
+		bus->nack = 1; // slave did not acknowledge the transfer
+		return SMBUS_NACK;
+	}
+	return 0;
+}
+//
+// Function to clock in 8 bits msb first, then ack (more bytes to follow)
+// or nack (last byte of the transfer). Returns the byte or SMBUS_TIMEOUT.
+static int read_byte(struct smbus *bus, int ack)
+{
+	const struct smbus_gpio *g = bus->gpio;
+	const struct smbus_timing *t = bus->timing;
+	int value = 0;
+	int i;
+	for (i = 0; i < 8; i++) // bit 7 down to bit 0
+	{
+		g->go_z(bus->data);
+		g->delay_us(t->setup);
+		if (clock_high(bus))
+		{
+			return SMBUS_TIMEOUT;
+		}
+		value = (value << 1) | (g->read_pin(bus->data) ? 1 : 0);
+		g->delay_us(t->high);
+		g->go_0(bus->clock); // clock low
+		g->delay_us(t->low);
+	}
+	bus->crc = smbus_crc8(bus->crc, value); // every byte on the bus is in the PEC
+	// ack/nack back to the slave
+	g->delay_us(t->ack_setup);
+	if (ack)
+	{
+		g->go_0(bus->data); // send ack
+	}
+	else
+	{
+		g->go_z(bus->data); // send nack
+	}
+	g->delay_us(t->setup);
+	if (clock_high(bus))
+	{
+		return SMBUS_TIMEOUT;
+	}
+	g->delay_us(t->high);
+	g->go_0(bus->clock); // clock low
+	g->go_0(bus->data); // data low
+	g->delay_us(ack ? t->read_gap : t->last_gap);
+	return value;
+}
+//
+// Function to send the address with write, the command byte, a repeated
+// start and the address with read. This starts every SMBus read. A read
+// that follows another in the same bus session starts with a repeated start.
+static int read_header(struct smbus *bus, int addr, int cmd, int repeated)
+{
+	int result = 0;
+	bus->nack = 0;
+	bus->timeout = 0;
+	bus->crc = 0;
+	if (repeated)
+	{
+		result = rpt_start(bus); // keep the bus from the last read
+	}
+	else
+	{
+		start_bus(bus); // send start condition
+	}
+	if (result == 0)
+	{
+		result = write_byte(bus, addr << 1); // send address with write
+	}
+	if (result == 0)
+	{
+		result = write_byte(bus, cmd); // load register pointer
+	}
+	if (result == 0)
+	{
+		result = rpt_start(bus); // send repeated start condition
+	}
+	if (result == 0)
+	{
+		result = write_byte(bus, (addr << 1) | 1); // send address with read
+	}
+	return result;
+}
+//
+// Function to read the low byte, high byte and PEC of a word read,
+// after read_header. Returns 0 to 0xffff or an SMBUS_ error.
+static int read_word_data(struct smbus *bus)
+{
+	int low = read_byte(bus, 1); // low byte then ack
+	int high = (low < 0) ? low : read_byte(bus, bus->pec); // high byte, nack if last
+	unsigned char crc = bus->crc; // PEC of all the bytes before the PEC byte
+	int pec = ((high < 0) || !bus->pec) ? 0 : read_byte(bus, 0); // PEC then nack
+	if (high < 0)
+	{
+		return high;
+	}
+	if (pec < 0)
+	{
+		return pec;
+	}
+	if (bus->pec && (pec != crc))
+	{
+		return SMBUS_PEC_ERROR;
+	}
+	return (high << 8) | low;
+}
+//
+// Function to call fn for each line of a fake or mock file, first to last,
+// with the newline taken off. The whole file is read first, whatever its
+// size. Returns 0, or -1 if the file can't be read.
+int smbus_file_lines(int fd, void (*fn)(char *line, void *arg), void *arg)
+{
+	struct stat st;
+	off_t size = 0;
+	if (fstat(fd, &st) < 0)
+	{
+		return -1;
+	}
+	char *file = malloc(st.st_size + 1);
+	if (!file)
+	{
+		return -1;
+	}
+	while (size < st.st_size)
+	{
+		ssize_t n = pread(fd, file + size, st.st_size - size, size);
+		if (n < 0)
+		{
+			free(file);
+			return -1;
+		}
+		if (n == 0)
+		{
+			break; // the file got shorter
+		}
+		size += n;
+	}
+	file[size] = 0;
+	char *line = file;
+	while (*line)
+	{
+		char *next = strchr(line, '\n'); // end of this line
+		if (next)
+		{
+			*next++ = 0;
+		}
+		else
+		{
+			next = line + strlen(line);
+		}
+		fn(line, arg);
+		line = next;
+	}
+	free(file);
+	return 0;
+}
+//
+// Register looked for in the fake bus file, and what was found
+struct fake_reg {
+	int addr;
+	int cmd;
+	int found; // 1 for a word, 2 for a string
+	int word;
+	unsigned char *text;
+	int len;
+};
+//
+// Function to check one line of the fake bus file for the register
+static void fake_line(char *line, void *arg)
+{
+	struct fake_reg *r = arg;
+	char *p = line;
+	if (*p == '#') // skip comment lines
+	{
+		return;
+	}
+	int line_addr = (int)strtol(p, &p, 0);
+	int line_cmd = (int)strtol(p, &p, 0);
+	while (*p == ' ' || *p == '\t')
+	{
+		p++;
+	}
+	if ((p == line) || (line_addr != r->addr) || (line_cmd != r->cmd))
+	{
+		return;
+	}
+	if (*p == '"') // string for a block read
+	{
+		char *end = strchr(++p, '"');
+		int n = end ? (int)(end - p) : (int)strlen(p);
+		if (n > SMBUS_BLOCK_MAX)
+		{
+			n = SMBUS_BLOCK_MAX;
+		}
+		memcpy(r->text, p, n);
+		r->len = n;
+		r->found = 2;
+	}
+	else if (*p) // number for a word read
+	{
+		r->word = (int)strtol(p, NULL, 0) & 0xffff;
+		r->found = 1;
+	}
+}
+//
+// Function to find a register in the fake bus file.
+// Returns 1 for a word (put in *word), 2 for a string (put in text),
+// 0 when the register is not in the file, or SMBUS_IO_ERROR if the file
+// can't be read. The last line for a register wins, so writes added to
+// the end replace the older value.
+static int fake_find(struct smbus *bus, int addr, int cmd,
+	int *word, unsigned char *text, int *len)
+{
+	struct fake_reg r = {addr, cmd, 0, 0, text, 0};
+	if (smbus_file_lines(bus->fd, fake_line, &r))
+	{
+		return SMBUS_IO_ERROR;
+	}
+	*word = r.word;
+	*len = r.len;
+	return r.found;
+}
+//
+// Function to change the errno of a failed i2c ioctl to an SMBUS_ error
+static int dev_error(struct smbus *bus)
+{
+	if (errno == ETIMEDOUT)
+	{
+		bus->timeout = 1;
+		return SMBUS_TIMEOUT;
+	}
+	if (errno == EPROTO) // bad block byte count
+	{
+		return SMBUS_BAD_LENGTH;
+	}
+	if (errno == EBADMSG) // PEC did not match
+	{
+		return SMBUS_PEC_ERROR;
+	}
+	bus->nack = 1; // ENXIO or EREMOTEIO when the slave does not ack
+	return SMBUS_NACK;
+}
+//
+// Function to point the i2c device at a slave address
+static int dev_address(struct smbus *bus, int addr)
+{
+	if (bus->dev_addr != addr)
+	{
+		if (ioctl(bus->fd, I2C_SLAVE, addr) < 0)
+		{
+			return SMBUS_IO_ERROR;
+		}
+		bus->dev_addr = addr;
+	}
+	return 0;
+}
+//
+// Function to do one SMBus transfer with the I2C_SMBUS ioctl.
+// Errors from the driver are changed to the SMBUS_ error codes.
+static int dev_transfer(struct smbus *bus, int addr, int read_write, int cmd,
+	int size, union i2c_smbus_data *buffer)
+{
+	struct i2c_smbus_ioctl_data args;
+	if (dev_address(bus, addr))
+	{
+		return SMBUS_IO_ERROR;
+	}
+	if (bus->dev_pec != bus->pec) // the kernel adds and checks the PEC byte
+	{
+		if (ioctl(bus->fd, I2C_PEC, bus->pec) < 0)
+		{
+			return SMBUS_IO_ERROR;
+		}
+		bus->dev_pec = bus->pec;
+	}
+	args.read_write = read_write;
+	args.command = cmd;
+	args.size = size;
+	args.data = buffer;
+	if (ioctl(bus->fd, I2C_SMBUS, &args) < 0)
+	{
+		return dev_error(bus);
+	}
+	return 0;
+}
+//
+// Function to read a word from the i2c device or the fake file
+static int dev_read_word(struct smbus *bus, int addr, int cmd)
+{
+	if (bus->fake)
+	{
+		int word, len;
+		unsigned char text[SMBUS_BLOCK_MAX];
+		int found = fake_find(bus, addr, cmd, &word, text, &len);
+		if (found < 0)
+		{
+			return found;
+		}
+		if (found != 1)
+		{
+			bus->nack = 1; // no such register acts like a nack
+			return SMBUS_NACK;
+		}
+		return word;
+	}
+	union i2c_smbus_data buffer;
+	int result = dev_transfer(bus, addr, I2C_SMBUS_READ, cmd,
+		I2C_SMBUS_WORD_DATA, &buffer);
+	if (result)
+	{
+		return result;
+	}
+	return buffer.word;
+}
+//
+// Function to read a block from the i2c device or the fake file
+static int dev_read_block(struct smbus *bus, int addr, int cmd,
+	unsigned char *buf, int size)
+{
+	unsigned char text[SMBUS_BLOCK_MAX];
+	int count;
+	if (bus->fake)
+	{
+		int word;
+		int found = fake_find(bus, addr, cmd, &word, text, &count);
+		if (found < 0)
+		{
+			return found;
+		}
+		if (found != 2)
+		{
+			bus->nack = 1;
+			return SMBUS_NACK;
+		}
+	}
+	else
+	{
+		union i2c_smbus_data buffer;
+		int result = dev_transfer(bus, addr, I2C_SMBUS_READ, cmd,
+			I2C_SMBUS_BLOCK_DATA, &buffer);
+		if (result)
+		{
+			return result;
+		}
+		count = buffer.block[0]; // the kernel checks count is 1 to 32
+		memcpy(text, &buffer.block[1], count);
+	}
+	memcpy(buf, text, (count < size) ? count : size);
+	return count;
+}
+//
+// Function to read several words from the i2c device in one I2C_RDWR
+// ioctl, a write of the command and a read of the word for each register,
+// joined by repeated starts. The kernel does not do the PEC for I2C_RDWR
+// so the PEC byte is read and checked here.
+static int dev_read_words(struct smbus *bus, int addr, const int *cmds,
+	int count, int *values)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS]; // 2 messages per register
+	unsigned char out[I2C_RDWR_IOCTL_MAX_MSGS / 2]; // command bytes
+	unsigned char in[I2C_RDWR_IOCTL_MAX_MSGS / 2][3]; // low, high and PEC
+	struct i2c_rdwr_ioctl_data args;
+	int len = bus->pec ? 3 : 2; // bytes read per register
+	int good = 0;
+	int first, i;
+	for (first = 0; first < count; first += I2C_RDWR_IOCTL_MAX_MSGS / 2)
+	{
+		int n = count - first; // registers in this ioctl
+		if (n > I2C_RDWR_IOCTL_MAX_MSGS / 2)
+		{
+			n = I2C_RDWR_IOCTL_MAX_MSGS / 2;
+		}
+		for (i = 0; i < n; i++)
+		{
+			out[i] = cmds[first + i];
+			msgs[2 * i].addr = addr;
+			msgs[2 * i].flags = 0; // write the command
+			msgs[2 * i].len = 1;
+			msgs[2 * i].buf = &out[i];
+			msgs[2 * i + 1].addr = addr;
+			msgs[2 * i + 1].flags = I2C_M_RD; // read the word
+			msgs[2 * i + 1].len = len;
+			msgs[2 * i + 1].buf = in[i];
+		}
+		args.msgs = msgs;
+		args.nmsgs = 2 * n;
+		int result = (ioctl(bus->fd, I2C_RDWR, &args) < 0) ? dev_error(bus) : 0;
+		for (i = 0; i < n; i++)
+		{
+			int *value = &values[first + i];
+			if (result)
+			{
+				*value = result; // the whole ioctl failed
+				continue;
+			}
+			*value = in[i][0] | (in[i][1] << 8);
+			if (bus->pec)
+			{
+				unsigned char crc = smbus_crc8(0, addr << 1);
+				crc = smbus_crc8(crc, out[i]);
+				crc = smbus_crc8(crc, (addr << 1) | 1);
+				crc = smbus_crc8(crc, in[i][0]);
+				crc = smbus_crc8(crc, in[i][1]);
+				if (crc != in[i][2])
+				{
+					*value = SMBUS_PEC_ERROR;
+					continue;
+				}
+			}
+			good++;
+		}
+	}
+	return good;
+}
+//
+// Function to write a word to the i2c device or the fake file
+static int dev_write_word(struct smbus *bus, int addr, int cmd, int value)
+{
+	if (bus->fake)
+	{
+		char line[40];
+		int n = snprintf(line, sizeof(line), "0x%02x 0x%02x 0x%04x\n",
+			addr, cmd, value & 0xffff);
+		if ((lseek(bus->fd, 0, SEEK_END) < 0) || (write(bus->fd, line, n) != n))
+		{
+			return SMBUS_IO_ERROR;
+		}
+		return 0;
+	}
+	union i2c_smbus_data buffer;
+	buffer.word = value & 0xffff;
+	return dev_transfer(bus, addr, I2C_SMBUS_WRITE, cmd,
+		I2C_SMBUS_WORD_DATA, &buffer);
+}
+//
+// Function to open a /dev/i2c-N device, or a regular file as a fake bus.
+// The fake bus has no PEC bytes so bus->pec makes no difference to it.
+int smbus_open_dev(struct smbus *bus, const char *path)
+{
+	struct stat st;
+	bus->gpio = 0;
+	bus->timing = 0;
+	bus->nack = 0;
+	bus->timeout = 0;
+	bus->stretch_us = 0;
+	bus->dev_addr = -1;
+	bus->dev_pec = 0;
+	bus->pec = 0;
+	bus->fd = open(path, O_RDWR);
+	if (bus->fd < 0)
+	{
+		return SMBUS_IO_ERROR;
+	}
+	if (fstat(bus->fd, &st) < 0)
+	{
+		smbus_close(bus);
+		return SMBUS_IO_ERROR;
+	}
+	bus->fake = S_ISREG(st.st_mode) ? 1 : 0;
+	return 0;
+}
+//
+// Function to close the i2c device
+void smbus_close(struct smbus *bus)
+{
+	if (bus->fd >= 0)
+	{
+		close(bus->fd);
+		bus->fd = -1;
+	}
+}
+//
+// Function to set up the GPIO library and float the bus
+int smbus_open(struct smbus *bus, const struct smbus_gpio *gpio,
+	enum smbus_speed speed, int clock, int data)
+{
+	bus->gpio = gpio;
+	bus->timing = &smbus_timings[speed];
+	bus->clock = clock;
+	bus->data = data;
+	bus->nack = 0;
+	bus->timeout = 0;
+	bus->stretch_us = 0;
+	bus->fd = -1; // no i2c device, use the GPIO pins
+	bus->fake = 0;
+	bus->pec = 0;
+	if (gpio->setup() != 0)
+	{
+		return -1;
+	}
+	gpio->go_z(clock); // set clock and data to inactive state
+	gpio->go_z(data);
+	gpio->delay_us(200); // wait before sending data
+	return 0;
+}
+//
+// Function to read a 16 bit register, low byte first.
+// Returns 0 to 0xffff, SMBUS_NACK, SMBUS_TIMEOUT or SMBUS_PEC_ERROR.
+int smbus_read_word(struct smbus *bus, int addr, int cmd)
+{
+	if (bus->fd >= 0)
+	{
+		bus->nack = 0;
+		bus->timeout = 0;
+		return dev_read_word(bus, addr, cmd);
+	}
+	int result = read_header(bus, addr, cmd, 0);
+	if (result == 0)
+	{
+		result = read_word_data(bus);
+	}
+	stop_bus(bus);
+	return result;
+}
+//
+// Function to read a list of 16 bit registers back to back in one bus
+// session. Each read after the first starts with a repeated start instead
+// of a stop and a new start. values[i] gets the word for cmds[i] or the
+// SMBUS_ error for that register. Returns the number of good words.
+int smbus_read_words(struct smbus *bus, int addr, const int *cmds,
+	int count, int *values)
+{
+	int good = 0;
+	int started = 0; // bus session is open
+	int i;
+	if (bus->fd >= 0)
+	{
+		bus->nack = 0;
+		bus->timeout = 0;
+		if (bus->fake)
+		{
+			for (i = 0; i < count; i++)
+			{
+				values[i] = dev_read_word(bus, addr, cmds[i]);
+				good += (values[i] >= 0);
+			}
+			return good;
+		}
+		return dev_read_words(bus, addr, cmds, count, values);
+	}
+	for (i = 0; i < count; i++)
+	{
+		int result = read_header(bus, addr, cmds[i], started);
+		if (result == 0)
+		{
+			result = read_word_data(bus);
+		}
+		values[i] = result;
+		good += (result >= 0);
+		if ((result >= 0) || (result == SMBUS_PEC_ERROR))
+		{
+			started = 1; // the transfer finished, keep the session open
+		}
+		else
+		{
+			stop_bus(bus); // free the bus and start again for the next one
+			started = 0;
+		}
+	}
+	if (started)
+	{
+		stop_bus(bus);
+	}
+	return good;
+}
+//
+// Function to read an SMBus block (byte count then data bytes).
+// Up to size bytes are put in buf. Returns the byte count, SMBUS_NACK,
+// SMBUS_TIMEOUT, SMBUS_BAD_LENGTH or SMBUS_PEC_ERROR.
+int smbus_read_block(struct smbus *bus, int addr, int cmd,
+	unsigned char *buf, int size)
+{
+	if (bus->fd >= 0)
+	{
+		bus->nack = 0;
+		bus->timeout = 0;
+		return dev_read_block(bus, addr, cmd, buf, size);
+	}
+	int result = read_header(bus, addr, cmd, 0);
+	if (result)
+	{
+		stop_bus(bus);
+		return result;
+	}
+	int count = read_byte(bus, 1); // byte count then ack
+	if (count < 0)
+	{
+		stop_bus(bus);
+		return count;
+	}
+	if ((count == 0) || (count > SMBUS_BLOCK_MAX))
+	{
+		read_byte(bus, 0); // nack a byte so the slave lets go of data
+		stop_bus(bus);
+		return SMBUS_BAD_LENGTH;
+	}
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		int value = read_byte(bus, (i < count - 1) || bus->pec); // nack the last byte
+		if (value < 0)
+		{
+			stop_bus(bus);
+			return value;
+		}
+		if (i < size)
+		{
+			buf[i] = value;
+		}
+	}
+	if (bus->pec)
+	{
+		unsigned char crc = bus->crc; // PEC of all the bytes before the PEC byte
+		int pec = read_byte(bus, 0); // PEC then nack
+		stop_bus(bus);
+		if (pec < 0)
+		{
+			return pec;
+		}
+		return (pec == crc) ? count : SMBUS_PEC_ERROR;
+	}
+	stop_bus(bus);
+	return count;
+}
+//
+// Function to write a 16 bit register, low byte first.
+// Note that there is no repeated start on a write.
+// Returns 0, SMBUS_NACK or SMBUS_TIMEOUT.
+int smbus_write_word(struct smbus *bus, int addr, int cmd, int value)
+{
+	int result;
+	bus->nack = 0;
+	bus->timeout = 0;
+	if (bus->fd >= 0)
+	{
+		return dev_write_word(bus, addr, cmd, value);
+	}
+	bus->crc = 0;
+	start_bus(bus); // send start condition
+	result = write_byte(bus, addr << 1); // send address with write
+	if (result == 0)
+	{
+		result = write_byte(bus, cmd); // load register pointer
+	}
+	if (result == 0)
+	{
+		result = write_byte(bus, value & 0xff); // send low byte
+	}
+	if (result == 0)
+	{
+		result = write_byte(bus, (value >> 8) & 0xff); // send high byte
+	}
+	if ((result == 0) && bus->pec)
+	{
+		result = write_byte(bus, bus->crc); // send PEC of the bytes above
+	}
+	stop_bus(bus);
+	return result;
+}
@@ -0,0 +1,121 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Bit-bang SMBus master shared by read_battery.c and monitor_battery.c.
+// The bus pins are driven through a table of GPIO functions so another
+// GPIO library can be plugged in, and every bus delay comes from a
+// timing table so the bus speed is tuned in one place.
+//
+// The same calls can instead go through a Linux /dev/i2c-N device, for
+// example the kernel i2c-gpio driver on the same two pins:
+//   dtoverlay=i2c-gpio,i2c_gpio_sda=19,i2c_gpio_scl=26
+// The kernel then does the bit timing, clock stretching and retries.
+// If the device path is a regular file it is read as a fake bus, one
+// register per line: address register value, for example
+//   0x0b 0x09 16200
+//   0x0b 0x20 "SONY"
+// Writes are added to the end of the file. smbus_file_lines reads such a
+// file line by line.
+//
+// When bus->pec is set each transfer carries the SMBus packet error code,
+// a CRC-8 of every byte on the bus, and a bad code gives SMBUS_PEC_ERROR.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release, replaces the unrolled
+//                          send8 and read16 in the battery programs
+// Rev 1.1 - Oct 17, 2026 - Wait for clock stretching, add 100 kHz timing
+// Rev 1.2 - Oct 17, 2026 - Add the i2c-dev and fake file transports
+// Rev 1.3 - Oct 17, 2026 - Add PEC (packet error code) checking
+// Rev 1.4 - Oct 17, 2026 - Add smbus_read_words, a register list in one bus session
+// Rev 1.5 - Oct 17, 2026 - Add smbus_file_lines, the whole fake file is read
+//
+#ifndef SMBUS_H
+#define SMBUS_H
+
+#define SMBUS_NACK -1 // slave did not acknowledge a byte
+#define SMBUS_BAD_LENGTH -2 // block read byte count is 0 or over 32
+#define SMBUS_TIMEOUT -3 // slave held the clock low too long
+#define SMBUS_IO_ERROR -4 // i2c device or fake file could not be used
+#define SMBUS_PEC_ERROR -5 // packet error code did not match the data
+#define SMBUS_BLOCK_MAX 32 // largest SMBus block transfer
+
+// GPIO functions used to move the bus pins
+struct smbus_gpio {
+	int (*setup)(void); // init the GPIO library, 0 when ok
+	void (*go_z)(int pin); // float the pin and let the pullup set the level
+	void (*go_0)(int pin); // drive the pin low
+	int (*read_pin)(int pin); // return the logic level on the pin
+	void (*delay_us)(unsigned int usec); // wait usec microseconds
+};
+
+// Bus delays in microseconds
+struct smbus_timing {
+	unsigned int start_wait; // bus idle time before a start condition
+	unsigned int start_hold; // data low to clock low in a start
+	unsigned int start_low; // clock low after a start
+	unsigned int setup; // data valid to clock high
+	unsigned int high; // clock high time
+	unsigned int low; // clock low time after the falling edge
+	unsigned int ack_wait; // wait before floating data for the slave ack
+	unsigned int ack_setup; // wait before the master drives its ack
+	unsigned int write_gap; // after each byte written (battery holds clock low)
+	unsigned int read_gap; // after each byte read and acked
+	unsigned int last_gap; // after the last byte read and nacked
+	unsigned int rpt_setup; // data high to clock high in a repeated start
+	unsigned int rpt_gap; // clock low after a repeated start
+	unsigned int stop_gap; // bus free time after a stop condition
+	unsigned int stretch_poll; // time between clock checks while stretched
+	unsigned int stretch_timeout; // give up when the clock stays low this long
+};
+
+// Timing table index
+enum smbus_speed {
+	SMBUS_25KHZ, // 10 usec quarter period, original logic analyzer tuned
+	SMBUS_100KHZ, // SMBus spec minimum times, relies on clock stretching
+	SMBUS_NUM_SPEEDS
+};
+
+// Bus state
+struct smbus {
+	const struct smbus_gpio *gpio; // GPIO functions
+	const struct smbus_timing *timing; // bus delays
+	int clock; // clock pin number
+	int data; // data pin number
+	int nack; // set to 1 when the slave gives a NACK
+	int timeout; // set to 1 when the slave stretched past stretch_timeout
+	unsigned long stretch_us; // total time the slave has held the clock low
+	int fd; // i2c device or fake file, -1 for the GPIO bit-bang bus
+	int fake; // set to 1 when fd is a fake register file
+	int dev_addr; // slave address last given to the i2c device
+	int dev_pec; // PEC setting last given to the i2c device
+	int pec; // set to 1 to send and check packet error codes
+	unsigned char crc; // PEC of the bytes so far in this transfer
+};
+
+extern const struct smbus_gpio smbus_wiringpi; // wiringPi GPIO functions
+extern const struct smbus_timing smbus_timings[SMBUS_NUM_SPEEDS]; // timing table
+
+int smbus_open(struct smbus *bus, const struct smbus_gpio *gpio,
+	enum smbus_speed speed, int clock, int data);
+unsigned char smbus_crc8(unsigned char crc, unsigned char value);
+int smbus_open_dev(struct smbus *bus, const char *path);
+void smbus_close(struct smbus *bus);
+int smbus_read_word(struct smbus *bus, int addr, int cmd);
+int smbus_read_words(struct smbus *bus, int addr, const int *cmds,
+	int count, int *values);
+int smbus_read_block(struct smbus *bus, int addr, int cmd,
+	unsigned char *buf, int size);
+int smbus_write_word(struct smbus *bus, int addr, int cmd, int value);
+int smbus_file_lines(int fd, void (*fn)(char *line, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,98 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Teensy i2c commands without running i2cset.
+// A command is sent as the two bytes 0x00 and the command, the same as
+// i2cset -y 1 0x08 0x00 <command>. The 0x00 byte points the register
+// block at register 0.
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Read the timing register window, teensy_read_perf
+// Rev 1.2 - Oct 17, 2026 - Read the mock file with smbus_file_lines
+// Rev 1.3 - Oct 17, 2026 - Mock register lines must hold the whole window
+// Rev 1.4 - Oct 17, 2026 - Drop the text and register reads, nothing used them
+//
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/i2c-dev.h>
+#include "teensy_ctl.h"
+
+// Function to write bytes to the Teensy, or log them in the mock file
+static int teensy_write(struct teensy *t, const unsigned char *bytes, int count)
+{
+	if (t->mock)
+	{
+		char line[64];
+		int n = 0;
+		int i;
+		for (i = 1; i < count; i++) // the first byte is always the register pointer
+		{
+			n += snprintf(line + n, sizeof(line) - n, "command 0x%02x\n", bytes[i]);
+		}
+		if ((lseek(t->fd, 0, SEEK_END) < 0) || (write(t->fd, line, n) != n))
+		{
+			return -1;
+		}
+		return 0;
+	}
+	return (write(t->fd, bytes, count) == count) ? 0 : -1;
+}
+//
+// Function to open the Teensy on an i2c device such as /dev/i2c-1,
+// or a regular file as a mock Teensy. Returns 0 or -1.
+int teensy_open(struct teensy *t, const char *path)
+{
+	struct stat st;
+	t->mock = 0;
+	t->fd = open(path, O_RDWR);
+	if (t->fd < 0)
+	{
+		return -1;
+	}
+	if (fstat(t->fd, &st) < 0)
+	{
+		teensy_close(t);
+		return -1;
+	}
+	if (S_ISREG(st.st_mode))
+	{
+		t->mock = 1;
+	}
+	else if (ioctl(t->fd, I2C_SLAVE, TEENSY_ADDR) < 0)
+	{
+		teensy_close(t);
+		return -1;
+	}
+	return 0;
+}
+//
+// Function to close the Teensy device
+void teensy_close(struct teensy *t)
+{
+	if (t->fd >= 0)
+	{
+		close(t->fd);
+		t->fd = -1;
+	}
+}
+//
+// Function to send one command byte, ie TEENSY_LED_ON. Returns 0 or -1.
+int teensy_command(struct teensy *t, int cmd)
+{
+	unsigned char bytes[2] = {0x00, cmd}; // register 0, then the command
+	return teensy_write(t, bytes, 2);
+}
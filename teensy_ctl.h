@@ -0,0 +1,88 @@
+/* Copyright 2018 Frank Adams
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+// Pi side of the Teensy i2c link (address 8 on /dev/i2c-1). The device
+// stays open so a command is one write() instead of running i2cset.
+// The commands and registers match receiveEvent() and requestEvent() in
+// Keyboard_and_Touchpad.ino.
+//
+// If the device path is a regular file it is used as a mock Teensy for
+// testing. Commands are added to the end of the file as lines like
+//   command 0x10
+// The registers can be read with i2cget, see requestEvent().
+//
+// Revision History
+// Rev 1.0 - Oct 17, 2026 - Original Release
+// Rev 1.1 - Oct 17, 2026 - Add the timing register window of firmware V4.9
+// Rev 1.2 - Oct 17, 2026 - Add the key event queue registers of firmware V5.1
+// Rev 1.3 - Oct 17, 2026 - Drop the unused text and register reads
+//
+#ifndef TEENSY_CTL_H
+#define TEENSY_CTL_H
+
+#define TEENSY_ADDR 0x08 // Teensy i2c slave address
+
+// Command bytes
+#define TEENSY_LED_ON 0x10 // turn on the disk led
+#define TEENSY_LED_OFF 0x11 // turn off the disk led
+#define TEENSY_TEXT_MODE 0x30 // reads give the battery text
+#define TEENSY_BINARY_MODE 0x31 // reads give the register block
+#define TEENSY_CLEAR_STATS 0x32 // clear the timing registers
+#define TEENSY_POWER_OFF 0x5a // turn off the power after a delay for the Pi to halt
+#define TEENSY_RESET 0xb7 // reset the Pi and the Teensy
+#define TEENSY_BLINK 0xe2 // blink the lcd off and back on
+
+// Registers in binary mode, 16 bits each, low byte first
+#define TEENSY_REG_BATTERY_MV 0 // battery voltage in mV
+#define TEENSY_REG_VERSION 1 // firmware version, 0x0503 is V5.3
+#define TEENSY_REG_STATUS 2 // status flags
+#define TEENSY_REG_TP_PARITY 3 // touchpad bytes with bad parity
+#define TEENSY_REG_TP_FRAME 4 // touchpad bytes with a bad start or stop bit
+#define TEENSY_REG_TP_OVERRUN 5 // touchpad bytes lost to a full buffer
+#define TEENSY_REG_KBD_SENT 6 // keyboard reports sent over usb
+#define TEENSY_REG_KBD_SAVED 7 // key changes that went out with another change
+#define TEENSY_REG_MOUSE_SENT 8 // mouse reports sent over usb
+#define TEENSY_REG_MOUSE_SAVED 9 // touchpad changes that went out with another one
+#define TEENSY_NUM_REGS 10
+
+// Timing registers, a second window starting at register TEENSY_REG_PERF.
+// Times are in usec. Each phase has min, avg and max, then a histogram of
+// TEENSY_HIST_BUCKETS where bucket n counts runs under 32 << n usec.
+#define TEENSY_REG_PERF 0x60 // register number of the first timing register
+#define TEENSY_PERF_TP_TIMEOUT 0 // touchpad bytes cut short and command timeouts
+#define TEENSY_PERF_ROLLOVER 1 // keyboard reports sent as ErrorRollOver
+#define TEENSY_PERF_TASK_MISSES 2 // task runs that were a whole period late
+#define TEENSY_PERF_KEY_QUEUE_FULL 3 // rows whose key changes waited for room in the key event queue
+#define TEENSY_PERF_PHASE 4 // first phase block
+#define TEENSY_PHASE_SCAN 0 // longest row tick of each matrix pass (timer match to the end of the interrupt)
+#define TEENSY_PHASE_TOUCHPAD 1 // touchpad packets
+#define TEENSY_PHASE_ADC 2 // battery adc average
+#define TEENSY_PHASE_USB 3 // usb reports sent
+#define TEENSY_PHASE_LOOP 4 // loop() pass that ran a task
+#define TEENSY_PHASE_KEY_LATENCY 5 // key change to its usb report
+#define TEENSY_NUM_PHASES 6
+#define TEENSY_HIST_BUCKETS 8
+#define TEENSY_PHASE_REGS (3 + TEENSY_HIST_BUCKETS) // min, avg, max, histogram
+#define TEENSY_NUM_PERF_REGS (TEENSY_PERF_PHASE + TEENSY_NUM_PHASES * TEENSY_PHASE_REGS)
+
+// Link state
+struct teensy {
+	int fd; // i2c device or mock file, -1 when closed
+	int mock; // set to 1 when fd is a mock file
+};
+
+int teensy_open(struct teensy *t, const char *path);
+void teensy_close(struct teensy *t);
+int teensy_command(struct teensy *t, int cmd);
+
+#endif